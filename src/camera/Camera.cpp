@@ -6,12 +6,18 @@ Camera::Camera(int width, int height)
 {
 	m_camera.setSize(sf::Vector2f(width, height));
 	m_camera.setCenter(sf::Vector2f(width / 2.f, height / 2.f)); // This set the camera to the center
+
+	m_last_center	= m_camera.getCenter();
+	m_last_size		= m_camera.getSize();
 }
 
 void Camera::setCamera(int width, int height)
 {
 	m_camera.setSize(sf::Vector2f(width, height));
 	m_camera.setCenter(sf::Vector2f(width / 2.f, height / 2.f)); // This set the camera to the center
+
+	m_last_center	= m_camera.getCenter();
+	m_last_size		= m_camera.getSize();
 }
 
 sf::IntRect Camera::getWorldBounds() const
@@ -41,3 +47,25 @@ void Camera::zoomOut()
 	//if (m_camera.getSize().x < 2000)
 	m_camera.zoom(1.1f);
 }
+
+// Measure how fast the view is moving and zooming, averaged over the last frames.
+// A single wheel step is a jump in size, averaging spreads it instead of reporting it as a huge rate for one frame.
+void Camera::update(float delta_time)
+{
+	if (delta_time <= 0.f)
+		return;
+
+	sf::Vector2f center	= m_camera.getCenter();
+	sf::Vector2f size	= m_camera.getSize();
+
+	// Exponential moving average, the weight depends on the frame time so it doesn't change with the frame rate
+	float weight = 1.f - std::exp(-delta_time / m_smoothing);
+
+	m_motion += ((center - m_last_center) / delta_time - m_motion) * weight;
+
+	if (m_last_size.x > 0.f)
+		m_zoom_trend += ((size.x / m_last_size.x - 1.f) / delta_time - m_zoom_trend) * weight;
+
+	m_last_center	= center;
+	m_last_size		= size;
+}
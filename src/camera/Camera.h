@@ -4,8 +4,15 @@
 
 class Camera
 {
-	sf::View	m_camera;
-	float		m_velocity{500.f};
+	sf::View		m_camera;
+	float			m_velocity{500.f};
+
+	// MOTION tracking (published to the map for prefetching)
+	sf::Vector2f	m_last_center{ 0.f, 0.f };
+	sf::Vector2f	m_last_size{ 0.f, 0.f };
+	sf::Vector2f	m_motion{ 0.f, 0.f };		// px per second
+	float			m_zoom_trend{ 0.f };		// relative size change per second (> 0 zooming out)
+	float			m_smoothing{ 0.2f };		// seconds the motion and zoom trend are averaged over
 
 public:
 	// CONSTRUCTORS
@@ -20,9 +27,12 @@ public:
 	void move(float x, float y);
 	void zoomIn();
 	void zoomOut();
+	void update(float delta_time);
 
 	// GETTERS
 	const sf::View& getCamera()		{ return m_camera; };
 	const float		getVelocity()		{ return m_velocity; };
+	sf::Vector2f	getMotion()		const	{ return m_motion; };
+	float			getZoomTrend()	const	{ return m_zoom_trend; };
 	sf::IntRect		getWorldBounds() const;
 };
\ No newline at end of file
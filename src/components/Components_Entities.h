@@ -29,6 +29,13 @@ enum class EntityType
     Animal_Cat
 };
 
+enum class SimulationTier
+{
+    Full,       // near the camera, updated every frame
+    Reduced,    // on a loaded chunk off screen, updated every few frames
+    Dormant     // on an unloaded chunk, coarse aggregate model
+};
+
 enum class ActionTypes 
 {
     Moving,
@@ -51,10 +58,10 @@ struct CPersonality
 {
     std::map<int, int> traits;
 
-    CPersonality() {
+    CPersonality(Random::Stream& rng) {
         for (int i = 0; i < static_cast<int>(PersonalityTrait::End); i++)
         {
-            traits[i] = Random::get(0, 100);
+            traits[i] = rng.get(0, 100);
         }
     }
 };
@@ -72,36 +79,129 @@ struct CBasicNeeds
 
 struct CMemory 
 {
-    std::unordered_map<Elements, sf::Vector2i> locations;
+    static constexpr std::size_t Slots = 4;     // locations remembered per element
+    static constexpr int MergeRadius = 128;     // px, sightings this close to a known location are the same place
+
+    struct Entry
+    {
+        sf::Vector2i    pos{ 0, 0 };
+        std::int64_t    timestamp{ -1 };        // game minutes, -1 is an empty slot
+    };
+
+    std::array<std::array<Entry, Slots>, ElementsCount> locations{};
 
     CMemory(){}
 
-    void rememberLocation(const sf::Vector2i& pos, const Elements& type)
+    // Refresh the closest slot within MergeRadius, so walking along a lake doesn't fill every slot with it.
+    // Only a new place replaces the oldest one.
+    void rememberLocation(const sf::Vector2i& pos, const Elements& type, std::int64_t timestamp)
+    {
+        auto& slots = locations[static_cast<std::size_t>(type)];
+        Entry* same = findClose(slots, pos);
+        Entry* target = same ? same : &slots[0];
+
+        if (!same)
+        {
+            for (auto& entry : slots)
+            {
+                if (entry.timestamp < target->timestamp)
+                    target = &entry;
+            }
+        }
+
+        target->pos = pos;
+        target->timestamp = timestamp;
+    }
+
+    // The place can't be used (e.g. no way to it), free its slot so another one is picked
+    void forgetLocation(const sf::Vector2i& pos, const Elements& type)
     {
-        locations[type] = pos;
+        if (Entry* entry = findClose(locations[static_cast<std::size_t>(type)], pos))
+            *entry = Entry{};
     }
 
-    void rememberLocation(const std::unordered_map<Elements, sf::Vector2i>& map)
+    void rememberLocation(const std::unordered_map<Elements, sf::Vector2i>& map, std::int64_t timestamp)
     {
         for(auto& [key, val] : map)
-            locations[key] = val;
+            rememberLocation(val, key, timestamp);
+    }
+
+    // Most recently seen location
+    std::optional<sf::Vector2i> getLocation(const Elements& type) const
+    {
+        const Entry* latest = nullptr;
+
+        for (const auto& entry : locations[static_cast<std::size_t>(type)])
+        {
+            if (entry.timestamp >= 0 && (!latest || entry.timestamp > latest->timestamp))
+                latest = &entry;
+        }
+
+        if (latest)
+            return latest->pos;
+        else
+            return std::nullopt;
     }
 
-    std::optional<sf::Vector2i> getLocation(const Elements& type)
+    // Remembered location closest to from
+    std::optional<sf::Vector2i> getNearest(const Elements& type, const sf::Vector2i& from) const
     {
-        const auto& it = locations.find(type);
+        const Entry* nearest = nullptr;
+        long long best{ 0 };
+
+        for (const auto& entry : locations[static_cast<std::size_t>(type)])
+        {
+            if (entry.timestamp < 0)
+                continue;
+
+            long long dx = entry.pos.x - from.x;
+            long long dy = entry.pos.y - from.y;
+            long long dist = dx * dx + dy * dy;
+
+            if (!nearest || dist < best)
+            {
+                nearest = &entry;
+                best = dist;
+            }
+        }
 
-        if (it != locations.end())
-            return it->second;
+        if (nearest)
+            return nearest->pos;
         else
             return std::nullopt;
     }
+
+private:
+    // Known location closest to pos within MergeRadius
+    static Entry* findClose(std::array<Entry, Slots>& slots, const sf::Vector2i& pos)
+    {
+        Entry* closest = nullptr;
+        long long best = static_cast<long long>(MergeRadius) * MergeRadius;
+
+        for (auto& entry : slots)
+        {
+            if (entry.timestamp < 0)
+                continue;
+
+            long long dx = entry.pos.x - pos.x;
+            long long dy = entry.pos.y - pos.y;
+            long long dist = dx * dx + dy * dy;
+
+            if (dist <= best)
+            {
+                closest = &entry;
+                best = dist;
+            }
+        }
+
+        return closest;
+    }
 };
 
 struct CTransform
 {
     float           speed{ 0.f };
-	sf::Vector2i    pos{ 0, 0 };
+	sf::Vector2i    pos{ 0, 0 };        // CPosition rounded to px, for the map queries
     sf::Vector2i    target{ 0, 0 };
 
 	CTransform(const sf::Vector2i& p, const float v)
@@ -109,6 +209,33 @@ struct CTransform
     {}
 };
 
+// MOVEMENT, hot components packed together by the movement group of the EntityManager
+struct CPosition
+{
+    sf::Vector2f value;
+
+    CPosition(const sf::Vector2f& p)
+        : value(p)
+    {}
+};
+
+struct CVelocity
+{
+    sf::Vector2f value{ 0.f, 0.f };     // px per second
+    float        dt{ 0.f };             // seconds to integrate on this tick, 0 when not updated
+
+    CVelocity() {}
+};
+
+struct CWaypoint
+{
+    sf::Vector2f value;                 // the integrator stops here
+
+    CWaypoint(const sf::Vector2f& p)
+        : value(p)
+    {}
+};
+
 struct CShape
 {
 	sf::CircleShape circle;
@@ -134,13 +261,29 @@ struct CCollision
 
 struct CVision
 {
-    float radius;
+    float                       radius;
+    sf::Vector2i                last_tile{ 0, 0 };      // tile of the last scan
+    std::optional<sf::Vector2i> scanned_from;           // position of the last scan
+    bool                        pending{ false };       // waiting in the perception queue
 
     CVision(float r = 250.f)
         : radius(r)
     {}
 };
 
+struct CSimulation
+{
+    SimulationTier  tier{ SimulationTier::Full };
+    std::uint32_t   phase{ 0 };         // spreads the reduced updates across frames
+    float           elapsed{ 0.f };     // seconds since the last update
+    float           delta{ 0.f };       // seconds covered by the current update
+    bool            active{ false };    // updated on this tick
+
+    CSimulation(std::uint32_t p)
+        : phase(p)
+    {}
+};
+
 struct CLifespan
 {
 	int remaining;
@@ -169,16 +312,38 @@ struct CAction
 {
     ActionTypes action_name;
 
-    CAction(ActionTypes action) : action_name(action) {}
+    CAction(ActionTypes action) : action_name(action) { countCreated(action); }
     virtual ~CAction() = default;
+
+private:
+    // Actions created per type, for the metrics
+    static void countCreated(ActionTypes action)
+    {
+        static std::array<Metrics::Counter*, 5> created
+        {
+            &Metrics::get().counter("actions.created.moving"),
+            &Metrics::get().counter("actions.created.eating"),
+            &Metrics::get().counter("actions.created.drinking"),
+            &Metrics::get().counter("actions.created.sleeping"),
+            &Metrics::get().counter("actions.created.idle")
+        };
+
+        created[static_cast<std::size_t>(action)]->add();
+    }
 };
 
 struct CMoving : public CAction
 {
     sf::Vector2i target;
-
-    CMoving(ActionTypes type, const sf::Vector2i& tgt = { 0, 0 })
-        : CAction(type), target(tgt) {
+    std::vector<sf::Vector2i> path;     // waypoints in px, filled by the pathfinder
+    std::size_t next{ 0 };              // waypoint being walked to
+    std::uint32_t path_id{ 0 };         // pending request, 0 if none was made
+    std::vector<sf::Vector2i> route;    // chunk entrances of a long trip in px, each leg is refined when reached
+    std::size_t leg{ 0 };               // route entry the current path leads to
+    std::optional<Elements> resource;   // follow the shared flow field of this element instead of a path
+
+    CMoving(ActionTypes type, const sf::Vector2i& tgt = { 0, 0 }, std::optional<Elements> res = std::nullopt)
+        : CAction(type), target(tgt), resource(res) {
     }
 };
 
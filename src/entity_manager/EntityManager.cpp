@@ -5,7 +5,10 @@
 
 void EntityManager::update()
 {
+	++m_tick;
+
 	// REMOVE ENTITIES 
+	Profiler::Timer timer{ "Entities/Cleanup" };
 	std::vector<entt::entity> toDestroy;
 
 	m_registry->view<CLifespan>().each([&](auto entity, CLifespan& life) 
@@ -16,67 +19,230 @@ void EntityManager::update()
 		}
 	});
 
+	static auto& destroyed	= Metrics::get().counter("entities.destroyed");
+	static auto& alive		= Metrics::get().gauge("entities.alive");
+
 	for (auto entity : toDestroy) 
 	{
 		m_registry->destroy(entity);
 		--m_total_entities;
 	}
 
+	destroyed.add(toDestroy.size());
+	alive.set(m_total_entities);
+
 	// UPDATE ENTITIES
 
-	// Update Memory (candidate for another thread?)
-	m_registry->view<CTransform, CMemory, CVision>().each([&](auto entity, auto& trs, auto& memory, auto& vision)
+	timer.next("Entities/Tiers");
+
+	// Simulation tiers, entities far from the camera are updated less often. Tiers are revised on each update
+	m_registry->view<CTransform, CSimulation>().each([&](auto entity, auto& trs, auto& sim)
 	{
-		memory.rememberLocation(m_map->getResourcesWithinBoundary(trs.pos, vision.radius));
+		sim.elapsed += m_delta_time;
+
+		std::uint32_t interval{ 1 };
+		if (sim.tier == SimulationTier::Reduced)
+			interval = m_reduced_interval;
+		else if (sim.tier == SimulationTier::Dormant)
+			interval = m_dormant_interval;
+
+		sim.active = (m_tick + sim.phase) % interval == 0;
+		if (!sim.active)
+			return;
+
+		sim.delta	= sim.elapsed;
+		sim.elapsed	= 0.f;
+
+		if (m_focus.contains(trs.pos))
+			sim.tier = SimulationTier::Full;
+		else if (m_map->isResident(trs.pos))
+			sim.tier = SimulationTier::Reduced;
+		else
+			sim.tier = SimulationTier::Dormant;
+	});
+
+	// Keep the chunks around the camera entities loaded, the others are free to go dormant
+	m_registry->view<CTransform, CSimulation>().each([&](auto entity, auto& trs, auto& sim)
+	{
+		if (sim.tier == SimulationTier::Full)
+			m_map->referenceChunk(trs.pos);
 	});
 
+	timer.next("Entities/Perception");
+
+	// Update Memory, only entities that crossed a tile are queued for a new scan
+	m_registry->view<CTransform, CMemory, CVision, CSimulation>().each([&](auto entity, auto& trs, auto& memory, auto& vision, auto& sim)
+	{
+		if (vision.pending || !sim.active || sim.tier == SimulationTier::Dormant)
+			return;
+
+		if (!vision.scanned_from || m_map->worldToTile(trs.pos) != vision.last_tile)
+		{
+			vision.pending = true;
+			m_perception_queue.push_back(entity);
+		}
+	});
+
+	// Scans are spread across frames
+	for (std::size_t scans = 0; scans < m_perception_budget && !m_perception_queue.empty(); )
+	{
+		entt::entity entity = m_perception_queue.front();
+		m_perception_queue.pop_front();
+
+		if (!m_registry->valid(entity) || !m_registry->all_of<CTransform, CMemory, CVision>(entity))
+			continue;
+
+		auto [trs, memory, vision] = m_registry->get<CTransform, CMemory, CVision>(entity);
+
+		// Close to the last scan, only the newly revealed crescent has to be checked
+		std::optional<sf::Vector2i> seen_from;
+		if (vision.scanned_from)
+		{
+			sf::Vector2i moved = trs.pos - *vision.scanned_from;
+			if (moved.x * moved.x + moved.y * moved.y < vision.radius * vision.radius)
+				seen_from = vision.scanned_from;
+		}
+
+		memory.rememberLocation(m_map->getResourcesWithinBoundary(trs.pos, vision.radius, seen_from), m_game_clock->getTimestamp());
+
+		vision.scanned_from	= trs.pos;
+		vision.last_tile	= m_map->worldToTile(trs.pos);
+		vision.pending		= false;
+
+		++scans;
+	}
+
 	// Moving
-	m_registry->view<CActionsQueue, CTransform>().each([&](auto entity, auto& queue, auto& trs)
+	timer.next("Entities/Moving");
+	m_pathfinder->update();
+	m_flow_fields->update();
+	deliverPaths();
+
+	m_registry->view<CActionsQueue, CTransform, CPosition, CVelocity, CWaypoint, CSimulation>().each([&](auto entity, auto& queue, auto& trs, auto& pos, auto& vel, auto& wp, auto& sim)
 	{
-		if (queue.actions.empty())
+		if (queue.actions.empty() || !sim.active)
 			return;
 
 		if(auto action = std::dynamic_pointer_cast<CMoving>(queue.actions.front()))
 		{
-			sf::Vector2i direction = action->target - trs.pos;
-			float distance = sqrt(direction.x * direction.x + direction.y * direction.y);
+			// No terrain around, straight line at an average speed
+			if (sim.tier == SimulationTier::Dormant)
+			{
+				sf::Vector2f direction = static_cast<sf::Vector2f>(action->target) - pos.value;
+				float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
 
-			if (distance > 0.5f) 
+				if (distance > 0.5f)
+				{
+					vel.value	= direction * (trs.speed * m_dormant_speed / distance);
+					vel.dt		= sim.delta;
+					wp.value	= static_cast<sf::Vector2f>(action->target);
+				}
+				else
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					queue.actions.pop_front();
+				}
+				return;
+			}
+
+			if (sim.tier == SimulationTier::Full)
+				m_map->referenceChunk(action->target);
+
+			// Heading to a resource, steer on the shared field while it covers the entity
+			std::optional<sf::Vector2i> flow;
+			if (action->resource)
+				flow = m_flow_fields->sample(*action->resource, trs.pos);
+
+			sf::Vector2i waypoint;
+
+			if (flow)
+			{
+				waypoint = *flow;
+			}
+			else
 			{
-				// Normalizing
-				direction.x /= distance;
-				direction.y /= distance;
+				// Ask for a path once, retry next frame if the pathfinder is busy
+				if (action->path_id == 0)
+				{
+					sf::Vector2i goal = action->route.empty() ? action->target : action->route[action->leg];
+					action->path_id = m_pathfinder->request(entity, trs.pos, goal);
+					return;
+				}
 
-				// Tile cost 
+				// Waiting for the search
+				if (action->path.empty())
+					return;
+
+				waypoint = action->path[action->next];
+			}
+
+			sf::Vector2f direction = static_cast<sf::Vector2f>(waypoint) - pos.value;
+			float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+
+			if (distance > 0.5f) 
+			{
+				// Tile cost, the integrator moves the entity and never overshoots the waypoint
 				float cost{ m_map->getTileCost(trs.pos) };
 
-				// Updating position
-				std::lock_guard<std::mutex> lock(m_mutex);
-				trs.pos.x += direction.x * trs.speed * m_delta_time * cost;
-				trs.pos.y += direction.y * trs.speed * m_delta_time * cost;
+				vel.value	= direction * (trs.speed * cost / distance);
+				vel.dt		= sim.delta;
+				wp.value	= static_cast<sf::Vector2f>(waypoint);
 			}
-			else
+			else if (flow)
+			{
+				// Center of a goal tile
+				if (m_map->worldToTile(*flow) == m_map->worldToTile(trs.pos))
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					queue.actions.pop_front();
+				}
+			}
+			else if (++action->next >= action->path.size())
 			{
+				// Next leg of a long trip
+				if (++action->leg < action->route.size())
+				{
+					action->path.clear();
+					action->next = 0;
+					action->path_id = 0;
+					return;
+				}
+
 				std::lock_guard<std::mutex> lock(m_mutex);
 				queue.actions.pop_front();
 			}
 		}
 	});
 
+	timer.next("Entities/Integrate");
+	integrate();
+
 	// Random Target
-	m_registry->view<CActionsQueue, CTransform, CVision>().each([&](auto entity, auto& queue, auto& trs, auto& vision)
+	timer.next("Entities/Wander");
+	m_registry->view<CActionsQueue, CTransform, CVision, CSimulation>().each([&](auto entity, auto& queue, auto& trs, auto& vision, auto& sim)
 	{
+		if (!sim.active || sim.tier == SimulationTier::Dormant)
+			return;
+
 		if (queue.actions.empty())
 		{
+			Random::Stream rng = getRandom(entity, Random::Purpose::Wander);
+
+			// No land around, try again next tick
+			auto target = m_map->getLocationWithinBound(trs.pos, vision.radius, rng);
+			if (!target)
+				return;
+
 			std::lock_guard<std::mutex> lock(m_mutex);
-			queue.actions.push_back(std::make_shared<CMoving>(ActionTypes::Moving, m_map->getLocationWithinBound(trs.pos, vision.radius)));
+			queue.actions.push_back(std::make_shared<CMoving>(ActionTypes::Moving, *target));
 		}
 	});
 
 	// Needs system
-	m_registry->view<CActionsQueue, CBasicNeeds, CMemory>().each([&](auto entity, auto& queue, auto& needs, auto& memory)
+	timer.next("Entities/Needs");
+	m_registry->view<CActionsQueue, CBasicNeeds, CMemory, CTransform, CSimulation>().each([&](auto entity, auto& queue, auto& needs, auto& memory, auto& trs, auto& sim)
 	{
-		if (queue.actions.empty())
+		if (queue.actions.empty() || !sim.active)
 			return;
 		
 		// PERFORMING ACTION NEEDS
@@ -136,11 +302,11 @@ void EntityManager::update()
 
 			if (it == queue.actions.end())
 			{ 
-				if (auto pos = memory.getLocation(Elements::ocean))
+				if (auto pos = memory.getNearest(Elements::ocean, trs.pos))
 				{
-					LOG_DEBUG("[MEMORY] Water {} {}", pos->x, pos->y);
+					LOG_DEBUG_RATE(m_memory_log_interval, "[MEMORY] Water {} {}", pos->x, pos->y);
 
-					queue.actions.push_back(std::make_shared<CMoving>( ActionTypes::Moving, *pos));
+					queue.actions.push_back(std::make_shared<CMoving>(ActionTypes::Moving, *pos, Elements::ocean));
 					queue.actions.push_back(std::make_shared<CDrinking>(ActionTypes::Drinking, m_game_clock->getTimestamp()));
 				}
 			}
@@ -160,11 +326,11 @@ void EntityManager::update()
 
 			if (it == queue.actions.end())
 			{
-				if (auto pos = memory.getLocation(Elements::hill))
+				if (auto pos = memory.getNearest(Elements::hill, trs.pos))
 				{
-					LOG_DEBUG("[MEMORY] Food {} {}", pos->x, pos->y);
+					LOG_DEBUG_RATE(m_memory_log_interval, "[MEMORY] Food {} {}", pos->x, pos->y);
 
-					queue.actions.push_back(std::make_shared<CMoving>(ActionTypes::Moving, *pos));
+					queue.actions.push_back(std::make_shared<CMoving>(ActionTypes::Moving, *pos, Elements::hill));
 					queue.actions.push_back(std::make_shared<CEating>(ActionTypes::Eating, m_game_clock->getTimestamp()));
 				}
 			}
@@ -190,8 +356,13 @@ void EntityManager::update()
 	});
 
 	// Update Entity info box
-	m_registry->view<CActionsQueue, CBasicNeeds, CEntityInfo>().each([&](auto entity, auto& queue, auto& needs, auto& info)
+	timer.next("Entities/Info");
+	m_registry->view<CActionsQueue, CBasicNeeds, CEntityInfo, CSimulation>().each([&](auto entity, auto& queue, auto& needs, auto& info, auto& sim)
 	{
+			// Only visible around the camera
+			if (sim.tier != SimulationTier::Full)
+				return;
+
 			if (info.text.empty())
 			{
 				// Hunger
@@ -245,9 +416,9 @@ void EntityManager::update()
 void EntityManager::render(sf::RenderTarget& window)
 {
 	// ENTITIES
-	m_registry->view<CShape, CTransform, CVision>().each([&](auto entity, auto& shape, auto& trs, auto& vsn)
+	m_registry->view<CShape, CPosition, CVision>().each([&](auto entity, auto& shape, auto& pos, auto& vsn)
 	{
-		shape.circle.setPosition(static_cast<sf::Vector2f>(trs.pos));
+		shape.circle.setPosition(pos.value);
 		window.draw(shape.circle);
 
 		// THIS IS JUST FOR TESTING AND NEEDS TO BE IMPROVED
@@ -255,14 +426,14 @@ void EntityManager::render(sf::RenderTarget& window)
 		{
 			sf::CircleShape circle(vsn.radius);
 			circle.setFillColor({ 255, 255, 255, 100 });
-			circle.setPosition(static_cast<sf::Vector2f>(trs.pos));
+			circle.setPosition(pos.value);
 			circle.setOrigin({ vsn.radius, vsn.radius });
 			window.draw(circle);
 		}
 	});
 
 	// INFO BOXES
-	m_registry->view<CTransform, CEntityInfo>().each([&](auto entity, auto& trs, auto& info)
+	m_registry->view<CPosition, CEntityInfo>().each([&](auto entity, auto& pos, auto& info)
 	{
 		if (info.text.empty())
 			return;
@@ -282,8 +453,8 @@ void EntityManager::render(sf::RenderTarget& window)
 
 		// Position the box right above the entity
 		info.shape.setPosition(sf::Vector2f{
-			trs.pos.x - info.shape.getSize().x / 2.f,
-			trs.pos.y - info.shape.getSize().y - padding
+			pos.value.x - info.shape.getSize().x / 2.f,
+			pos.value.y - info.shape.getSize().y - padding
 			});
 
 		window.draw(info.shape);
@@ -305,21 +476,48 @@ void EntityManager::render(sf::RenderTarget& window)
 
 /// MANAGING ENTITIES //////////////////////////////////////////////////////////////
 
-void EntityManager::addEntity(const EntityType& type)
+// Hint asks for a specific id (loading a save), a free one is used if it's taken.
+entt::entity EntityManager::addEntity(const EntityType& type, entt::entity hint)
 {
-	auto entity = m_registry->create();
+	static auto& created = Metrics::get().counter("entities.created");
+
+	auto entity = hint == entt::null ? m_registry->create() : m_registry->create(hint);
+
+	Random::Stream rng = getRandom(entity, Random::Purpose::Personality);
 
 	m_registry->emplace<CType>(entity, type);
+	m_registry->emplace<CPersonality>(entity, rng);
 	m_registry->emplace<CLifespan>(entity, 100);
 	m_registry->emplace<CTransform>(entity, sf::Vector2i{ 0, 0 }, 100.f);
+	m_registry->emplace<CPosition>(entity, sf::Vector2f{ 0.f, 0.f });
+	m_registry->emplace<CVelocity>(entity);
+	m_registry->emplace<CWaypoint>(entity, sf::Vector2f{ 0.f, 0.f });
 	m_registry->emplace<CShape>(entity, 10, 4, sf::Color::White);
 	m_registry->emplace<CVision>(entity);
 	m_registry->emplace<CMemory>(entity);
 	m_registry->emplace<CBasicNeeds>(entity);
 	m_registry->emplace<CActionsQueue>(entity);
+	m_registry->emplace<CSimulation>(entity, static_cast<std::uint32_t>(entt::to_integral(entity)));
 	m_registry->emplace<CEntityInfo>(entity, 60, 40);
 
 	++m_total_entities;
+	created.add();
+
+	return entity;
+}
+
+// Remove every entity. Searches still running are ignored on arrival, their entities are gone
+void EntityManager::clear()
+{
+	m_registry->clear();
+	m_perception_queue.clear();
+	m_total_entities = 0;
+}
+
+// Area of the world (px) the camera shows, entities in and around it run at full fidelity.
+void EntityManager::setFocus(const sf::IntRect& view)
+{
+	m_focus = sf::IntRect{ view.position - sf::Vector2i{ m_focus_margin, m_focus_margin }, view.size + sf::Vector2i{ 2 * m_focus_margin, 2 * m_focus_margin } };
 }
 
 // Add a moving action with assosciated target position.
@@ -334,6 +532,79 @@ void EntityManager::nextTarget(const EntityType& type, sf::Vector2i& target)
 	});
 }
 
+// Advance the packed movement components, then mirror the positions used by the map queries.
+void EntityManager::integrate()
+{
+	auto group = m_registry->group<CPosition, CVelocity, CWaypoint>(entt::get<CTransform>);
+
+	group.each([](auto& pos, auto& vel, auto& wp, auto& trs)
+	{
+		sf::Vector2f step		= vel.value * vel.dt;
+		sf::Vector2f remaining	= wp.value - pos.value;
+
+		// A reduced update covers several frames, stop on the waypoint instead of going past it
+		bool arrived = step.x * step.x + step.y * step.y >= remaining.x * remaining.x + remaining.y * remaining.y;
+
+		pos.value	= arrived ? wp.value : pos.value + step;
+		vel.dt		= 0.f;
+
+		trs.pos = sf::Vector2i{ static_cast<int>(std::lround(pos.value.x)), static_cast<int>(std::lround(pos.value.y)) };
+	});
+}
+
+// Hand finished searches to the moving action that asked for them. Unreachable targets are dropped.
+void EntityManager::deliverPaths()
+{
+	while (auto result = m_pathfinder->poll())
+	{
+		if (!m_registry->valid(result->entity) || !m_registry->all_of<CActionsQueue>(result->entity))
+			continue;
+
+		auto& queue = m_registry->get<CActionsQueue>(result->entity);
+		if (queue.actions.empty())
+			continue;
+
+		// The action may have been replaced while the search was running
+		auto action = std::dynamic_pointer_cast<CMoving>(queue.actions.front());
+		if (!action || action->path_id != result->id)
+			continue;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (result->found && result->coarse)
+		{
+			// Refined leg by leg by the moving system
+			action->route	= std::move(result->path);
+			action->leg		= 0;
+			action->path_id	= 0;
+		}
+		else if (result->found)
+		{
+			action->path = std::move(result->path);
+			action->next = 0;
+		}
+		else
+		{
+			queue.actions.pop_front();
+
+			if (action->resource)
+			{
+				// The drink or meal waiting at the end of the trip can't happen either
+				if (!queue.actions.empty())
+				{
+					CAction* next = queue.actions.front().get();
+					if (dynamic_cast<CDrinking*>(next) || dynamic_cast<CEating*>(next))
+						queue.actions.pop_front();
+				}
+
+				// Unreachable, so the next query picks another place
+				if (auto* memory = m_registry->try_get<CMemory>(result->entity))
+					memory->forgetLocation(action->target, *action->resource);
+			}
+		}
+	}
+}
+
 // HELPER FUNCTION
 void EntityManager::addTextToEntityInfo(std::vector<sf::Text>& vec, std::string&& s, int size, const sf::Color& color)
 {
@@ -1,23 +1,50 @@
 #pragma once
 
 #include "../map_generator/MapGenerator.h"
+#include "../pathfinding/Pathfinder.h"
+#include "../pathfinding/FlowField.h"
 #include "Components_Entities.h"
 
 class EntityManager
 {
 
 	int								m_total_entities{ 0 };
+	std::uint64_t					m_tick{ 0 };		// simulation updates since start, keys the random streams
 	float&							m_delta_time;
 	sf::Font&						m_font;
 	std::unique_ptr<entt::registry>	m_registry;
 	std::shared_ptr<MapGenerator>	m_map;
 	std::shared_ptr<GameClock>		m_game_clock;
 	std::mutex						m_mutex;
-	BS::thread_pool<>				m_threads{ 2 };
+	BS::thread_pool<>				m_threads{ 2, [](std::size_t index) { Trace::get().setThreadName("entity worker " + std::to_string(index)); } };
+	std::unique_ptr<Pathfinder>		m_pathfinder;		// searches run on m_threads
+	std::unique_ptr<FlowFields>		m_flow_fields;		// shared by entities heading to a resource
+
+	// LEVEL OF DETAIL
+	sf::IntRect						m_focus;						// world px simulated at full fidelity
+	int								m_focus_margin{ 256 };			// px around the view still at full fidelity
+	std::uint32_t					m_reduced_interval{ 8 };		// ticks between updates off screen
+	std::uint32_t					m_dormant_interval{ 32 };		// ticks between updates on unloaded chunks
+	float							m_dormant_speed{ 0.5f };		// average terrain speed of the aggregate model
+
+	// PERCEPTION
+	std::deque<entt::entity>		m_perception_queue;			// entities waiting for a vision scan
+	std::size_t						m_perception_budget{ 64 };	// scans per frame
+
+	// LOGGING
+	std::int64_t					m_memory_log_interval{ 1000 };	// ms between [MEMORY] lines, they fire per entity
 
 	// Private function
+	void deliverPaths();
+	void integrate();
 	void addTextToEntityInfo(std::vector<sf::Text>& vec, std::string&& s, int size, const sf::Color& color);
 
+	// Reproducible random numbers for an entity on the current tick
+	Random::Stream getRandom(entt::entity entity, Random::Purpose purpose) const
+	{
+		return Random::Stream{ static_cast<std::uint64_t>(m_map->getSeed()), static_cast<std::uint64_t>(entt::to_integral(entity)), m_tick, purpose };
+	}
+
 public:
 
 	bool show_vision = false;
@@ -31,6 +58,12 @@ public:
 	{
 		m_registry = std::make_unique<entt::registry>();
 
+		// Owning group, keeps the movement components packed in the same order
+		m_registry->group<CPosition, CVelocity, CWaypoint>(entt::get<CTransform>);
+
+		m_pathfinder = std::make_unique<Pathfinder>(m_map, m_threads);
+		m_flow_fields = std::make_unique<FlowFields>(m_map, m_threads);
+
 		// THREADS TO BE IMPLEMENTED
 		//m_threads.submit_task([this] { startChunksGenerator(); });
 	}
@@ -38,11 +71,18 @@ public:
 	// MAIN FUNCTIONS
 	void render(sf::RenderTarget& window);
 	void update();
-	void addEntity(const EntityType& type);
+	entt::entity addEntity(const EntityType& type, entt::entity hint = entt::null);
+	void clear();
+	void waitForWorkers() { m_threads.wait(); }	// lockstep replays, every search lands on the next frame
 
 	// SETTERS
+	void setFocus(const sf::IntRect& view);
 	void nextTarget(const EntityType& type, sf::Vector2i& targ);
 
+	void setTick(std::uint64_t tick) { m_tick = tick; }
+
 	// GETTERS
 	//const EntityVec& getEntities(const EntityType& type);
+	entt::registry&	getRegistry()		{ return *m_registry; }
+	std::uint64_t	getTick()	const	{ return m_tick; }
 };
\ No newline at end of file
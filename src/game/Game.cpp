@@ -3,6 +3,16 @@
 
 #include "Game.h"
 
+namespace
+{
+	// Saving and loading read and write files the recording doesn't hold, a replay must not repeat them
+	bool isSaveKey(const sf::Event& event)
+	{
+		const auto* key = event.getIf<sf::Event::KeyPressed>();
+		return key && (key->code == sf::Keyboard::Key::F6 || key->code == sf::Keyboard::Key::F9);
+	}
+}
+
 // GAME FLOW ////////////////////////////////////////////////////////////
 
 Game::Game(const std::string& path)
@@ -11,7 +21,25 @@ Game::Game(const std::string& path)
 	nlohmann::json data = nlohmann::json::parse(f);
 
 	// LOGGER
-	Logger::init(data["logger"]["file"]);
+	Logger::init(data["logger"]["file"], data["logger"]["level"], data["logger"]["async"], data["logger"]["queue_size"]);
+	Trace::get().setThreadName("main");
+	m_trace_file = data["logger"]["trace"];
+
+	// REPLAY, a recording brings the config it was made with
+	nlohmann::json replay = data["replay"];
+	std::string replay_mode = replay["mode"];
+
+	if (replay_mode == "play" && m_replay.startPlaying(replay["file"]))
+	{
+		data = nlohmann::json::parse(m_replay.getConfig());
+		m_headless = replay["headless"];
+	}
+
+	m_lockstep = replay_mode != "off" && replay["lockstep"];
+
+	// METRICS
+	m_metrics_file		= data["metrics"]["file"];
+	m_metrics_interval	= data["metrics"]["interval"];
 
 	// WINDOW AND FRAME
 	sf::State state;
@@ -24,6 +52,13 @@ Game::Game(const std::string& path)
 	m_window.create(sf::VideoMode({ data["window"]["width"], data["window"]["height"] }), "One Of Twenty", state);
 	m_window.setFramerateLimit(data["window"]["frames"]);
 
+	// Deltas come from the recording, frames can run as fast as they go
+	if (m_headless)
+	{
+		m_window.setVisible(false);
+		m_window.setFramerateLimit(0);
+	}
+
 	// IN GAME CLOCK
 	LOG_DEBUG("Creating in Game Clock.");
 	m_game_clock = std::make_shared<GameClock>(120.f);
@@ -48,6 +83,13 @@ Game::Game(const std::string& path)
 	LOG_DEBUG("Creating Map Generator.");
 	m_map = std::make_shared<MapGenerator>(m_font, m_currentFrame, data["map"]["file"]);
 	m_map->setDebugNoiseView(false);
+	m_map->setMeshBuilding(!m_headless);
+
+	if (m_replay.isPlaying())
+	{
+		m_map->setSeed(m_replay.getSeed());
+		m_map->setNoises();
+	}
 
 	// HUD
 	LOG_DEBUG("Creating HUD.");
@@ -63,6 +105,14 @@ Game::Game(const std::string& path)
 	// ENTITIES MANAGER
 	LOG_DEBUG("Creating Entities Manager.");
 	m_entity_manager = std::make_unique<EntityManager>(m_font, m_map, m_game_clock, m_deltaTime);
+
+	// SAVES
+	m_save = std::make_unique<SaveGame>(m_map, m_game_clock, *m_entity_manager);
+	m_save_file = data["save"]["file"];
+
+	// Recording starts once the world exists, with the seed it was built from
+	if (replay_mode == "record")
+		m_replay.startRecording(replay["file"], data.dump(), m_map->getSeed());
 }
 
 void Game::run()
@@ -70,21 +120,58 @@ void Game::run()
 	
 	while (m_running)
 	{
-		m_deltaTime = m_clock.restart().asSeconds();
-		m_game_clock->update(m_deltaTime);
+		// The profiler keeps the real frame time, a replay simulates the recorded one
+		float frame_time = m_clock.restart().asSeconds();
+		m_deltaTime = m_replay.beginFrame(m_currentFrame, frame_time);
 
-		if (!m_paused)
+		if (m_replay.isFinished())
 		{
-			sMovement();
-			sCollision();
+			LOG_INFO("Replay finished after {} frames.", m_currentFrame);
+			break;
 		}
 
-		sUserInput();
-		sRender();
+		m_game_clock->update(m_deltaTime);
 
+		{
+			Profiler::Timer timer{ "Game/Movement" };
+
+			if (!m_paused)
+			{
+				sMovement();
+				timer.next("Game/Collision");
+				sCollision();
+			}
+
+			timer.next("Game/UserInput");
+			sUserInput();
+			timer.next("Game/Render");
+			sRender();
+
+			if (m_lockstep)
+			{
+				timer.next("Game/Lockstep");
+				m_map->waitForWorkers();
+				m_entity_manager->waitForWorkers();
+			}
+		}
+
+		m_replay.endFrame();
+		Profiler::get().endFrame(frame_time * 1000.f);
 		++m_currentFrame;
+
+		// Long runs keep a recent copy on disk
+		m_metrics_elapsed += m_deltaTime;
+		if (m_metrics_elapsed >= m_metrics_interval)
+		{
+			m_metrics_elapsed = 0.f;
+
+			if (!Metrics::get().dump(m_metrics_file))
+				LOG_WARN_RATE(60000, "Could not write the metrics to {}.", m_metrics_file);
+		}
 	}
 
+	Metrics::get().dump(m_metrics_file);
+
 }
 
 void Game::setPaused()
@@ -106,6 +193,7 @@ void Game::spawnEntities()
 void Game::sMovement()
 {
 	// Entities Updates
+	m_entity_manager->setFocus(m_camera->getWorldBounds());
 	m_entity_manager->update();
 
 
@@ -139,9 +227,17 @@ void Game::sRender()
 {
 	m_window.clear();
 
+	// Publish camera motion so the map can generate ahead of it
+	m_camera->update(m_deltaTime);
+	m_map->setCameraMotion(m_camera->getMotion(), m_camera->getZoomTrend());
+
 	m_window.setView(m_camera->getCamera());
 	m_map->render(m_camera->getWorldBounds(), m_window);
 
+	// The map still runs, it streams the chunks in
+	if (m_headless)
+		return;
+
 	m_entity_manager->render(m_window);
 	
 	m_window.setView(m_hud->getCamera());
@@ -153,156 +249,217 @@ void Game::sRender()
 
 void Game::sUserInput()
 {
+	// Window events drive the game, unless a recording is playing
+	std::vector<sf::Event> events;
+
 	while (const std::optional event = m_window.pollEvent())
 	{
-		if (event->is<sf::Event::Closed>())
+		if (!m_replay.isPlaying())
+		{
+			if (!isSaveKey(*event))
+				m_replay.record(*event);
+
+			events.push_back(*event);
+		}
+		else if (event->is<sf::Event::Closed>())
 		{
 			m_running = false;
 		}
+	}
 
-		// KEYBOARD LOGIC
-		if (const auto* keyPressed = event->getIf<sf::Event::KeyPressed>())
+	if (m_replay.isPlaying())
+		events = m_replay.takeEvents();
+
+	for (const auto& event : events)
+		handleEvent(event);
+}
+
+void Game::handleEvent(const sf::Event& event)
+{
+	if (event.is<sf::Event::Closed>())
+	{
+		m_running = false;
+	}
+
+	// KEYBOARD LOGIC
+	if (const auto* keyPressed = event.getIf<sf::Event::KeyPressed>())
+	{
+		if (keyPressed->code == sf::Keyboard::Key::P)
 		{
-			if (keyPressed->code == sf::Keyboard::Key::P)
-			{
-				setPaused();
-			}
+			setPaused();
+		}
 
-			if (!m_paused)
-			{
-				if (keyPressed->code == sf::Keyboard::Key::W)
-					m_camera->cInput->up = true;
-				if (keyPressed->code == sf::Keyboard::Key::S)
-					m_camera->cInput->down = true;
-				if (keyPressed->code == sf::Keyboard::Key::A)
-					m_camera->cInput->left = true;
-				if (keyPressed->code == sf::Keyboard::Key::D)
-					m_camera->cInput->right = true;
-				if (keyPressed->code == sf::Keyboard::Key::M)
-					m_map->setSeed();
-				if (keyPressed->code == sf::Keyboard::Key::G)
-					m_map->setDebugWireFrame(true);
-				if (keyPressed->code == sf::Keyboard::Key::Num1)
-					m_entity_manager->addEntity(EntityType::Human_Generic);
-			}
+		if (keyPressed->code == sf::Keyboard::Key::F3)
+		{
+			m_hud->toggleProfiler();
 		}
 
-		if (const auto* keyReleased = event->getIf<sf::Event::KeyReleased>())
+		if (keyPressed->code == sf::Keyboard::Key::F4)
 		{
-			if (!m_paused)
+			bool started = Trace::get().flush(m_trace_file, [file = m_trace_file](bool written)
 			{
-				switch (keyReleased->code)
-				{
-				case sf::Keyboard::Key::W:
-					m_camera->cInput->up = false;
-					break;
-				case sf::Keyboard::Key::S:
-					m_camera->cInput->down = false;
-					break;
-				case sf::Keyboard::Key::A:
-					m_camera->cInput->left = false;
-					break;
-				case sf::Keyboard::Key::D:
-					m_camera->cInput->right = false;
-					break;
-				case sf::Keyboard::Key::G:
-					m_map->setDebugWireFrame(false);
-					break;
-						
-				default: break;
-				}
-			}
+				if (written)
+					LOG_INFO("Trace written to {}.", file);
+				else
+					LOG_ERROR("Could not write the trace to {}.", file);
+			});
+
+			if (!started)
+				LOG_WARN("The previous trace is still being written.");
 		}
 
-		// TEXT INPUT LOGIC
-		if (const auto* textEntered = event->getIf<sf::Event::TextEntered>())
+		if (keyPressed->code == sf::Keyboard::Key::F5)
 		{
-			m_hud->input(*textEntered);
+			m_hud->toggleMetrics();
 		}
 
-		// MOUSE BUTTONS LOGIC
-		if (const auto* mousePressed = event->getIf<sf::Event::MouseButtonPressed>())
+		// Recordings made before save keys were filtered out may still hold them
+		if (keyPressed->code == sf::Keyboard::Key::F6 && !m_replay.isPlaying())
 		{
-			if (!m_paused)
+			if (!m_save->save(m_save_file))
+				LOG_WARN("The previous save is still being written.");
+		}
+
+		if (keyPressed->code == sf::Keyboard::Key::F9 && !m_replay.isPlaying())
+		{
+			if (m_save->isSaving())
+				LOG_WARN("Wait for the save to finish before loading.");
+			else
+				m_save->load(m_save_file);
+		}
+
+		if (!m_paused)
+		{
+			if (keyPressed->code == sf::Keyboard::Key::W)
+				m_camera->cInput->up = true;
+			if (keyPressed->code == sf::Keyboard::Key::S)
+				m_camera->cInput->down = true;
+			if (keyPressed->code == sf::Keyboard::Key::A)
+				m_camera->cInput->left = true;
+			if (keyPressed->code == sf::Keyboard::Key::D)
+				m_camera->cInput->right = true;
+			if (keyPressed->code == sf::Keyboard::Key::M)
+				m_map->setSeed(m_replay.value(Random::get(1, 1000000)));
+			if (keyPressed->code == sf::Keyboard::Key::G)
+				m_map->setDebugWireFrame(true);
+			if (keyPressed->code == sf::Keyboard::Key::Num1)
+				m_entity_manager->addEntity(EntityType::Human_Generic);
+		}
+	}
+
+	if (const auto* keyReleased = event.getIf<sf::Event::KeyReleased>())
+	{
+		if (!m_paused)
+		{
+			switch (keyReleased->code)
 			{
-				switch (mousePressed->button)
-				{
-				case sf::Mouse::Button::Left:
-				{
-					auto pixel = sf::Mouse::getPosition(m_window);
+			case sf::Keyboard::Key::W:
+				m_camera->cInput->up = false;
+				break;
+			case sf::Keyboard::Key::S:
+				m_camera->cInput->down = false;
+				break;
+			case sf::Keyboard::Key::A:
+				m_camera->cInput->left = false;
+				break;
+			case sf::Keyboard::Key::D:
+				m_camera->cInput->right = false;
+				break;
+			case sf::Keyboard::Key::G:
+				m_map->setDebugWireFrame(false);
+				break;
+					
+			default: break;
+			}
+		}
+	}
 
-					// GUI coords
-					sf::Vector2f guiPos = m_window.mapPixelToCoords(pixel, m_hud->getCamera());
-					m_hud->input(*mousePressed, guiPos);
+	// TEXT INPUT LOGIC
+	if (const auto* textEntered = event.getIf<sf::Event::TextEntered>())
+	{
+		m_hud->input(*textEntered);
+	}
 
-					// World coords
-					sf::Vector2f worldPos = m_window.mapPixelToCoords(pixel, m_camera->getCamera());
-					m_hud->infoBox(m_map->getPositionInfo(static_cast<sf::Vector2i>(worldPos)));
+	// MOUSE BUTTONS LOGIC
+	if (const auto* mousePressed = event.getIf<sf::Event::MouseButtonPressed>())
+	{
+		if (!m_paused)
+		{
+			switch (mousePressed->button)
+			{
+			case sf::Mouse::Button::Left:
+			{
+				auto pixel = mousePressed->position;
 
-					// TEST map change tile
-					m_map->setTileColor(static_cast<sf::Vector2i>(worldPos), Elements::test);
+				// GUI coords
+				sf::Vector2f guiPos = m_window.mapPixelToCoords(pixel, m_hud->getCamera());
+				m_hud->input(*mousePressed, guiPos);
 
-					// TESTING ENTITY MOVING
-					//m_entity_manager->nextTarget(EntityType::Human_Generic, worldPos);
+				// World coords
+				sf::Vector2f worldPos = m_window.mapPixelToCoords(pixel, m_camera->getCamera());
+				m_hud->infoBox(m_map->getPositionInfo(static_cast<sf::Vector2i>(worldPos)));
 
-					break;
-				}
+				// TEST map change tile
+				m_map->setTileColor(static_cast<sf::Vector2i>(worldPos), Elements::test);
 
-				case sf::Mouse::Button::Right:
-				{
-					// Right click logic
-					break;
-				}
+				// TESTING ENTITY MOVING
+				//m_entity_manager->nextTarget(EntityType::Human_Generic, worldPos);
 
-				default: break;
-				}
+				break;
 			}
-		}
-		
-		// MOUSE CLICK RELEASED
-		if (const auto* mousereleased = event->getIf<sf::Event::MouseButtonReleased>())
-		{
-			if (!m_paused)
+
+			case sf::Mouse::Button::Right:
 			{
-				switch (mousereleased->button)
-				{
-				case sf::Mouse::Button::Left:
-				{
-					auto pixel = sf::Mouse::getPosition(m_window);
-					sf::Vector2f mouseWorldPos = m_window.mapPixelToCoords(pixel, m_camera->getCamera());
-					sf::Vector2f mouseHudPos = m_window.mapPixelToCoords(pixel, m_hud->getCamera());
-
-					m_hud->input(*mousereleased, mouseHudPos);
-				}
-				}
+				// Right click logic
+				break;
 			}
-		}
 
-		// MOUSE MOVING
-		if (const auto* mousemoved = event->getIf<sf::Event::MouseMoved>())
+			default: break;
+			}
+		}
+	}
+	
+	// MOUSE CLICK RELEASED
+	if (const auto* mousereleased = event.getIf<sf::Event::MouseButtonReleased>())
+	{
+		if (!m_paused)
 		{
-			if (!m_paused)
+			switch (mousereleased->button)
+			{
+			case sf::Mouse::Button::Left:
 			{
-				auto pixel = sf::Mouse::getPosition(m_window);
+				auto pixel = mousereleased->position;
 				sf::Vector2f mouseWorldPos = m_window.mapPixelToCoords(pixel, m_camera->getCamera());
 				sf::Vector2f mouseHudPos = m_window.mapPixelToCoords(pixel, m_hud->getCamera());
 
-				m_hud->input(*mousemoved, mouseHudPos);
+				m_hud->input(*mousereleased, mouseHudPos);
+			}
 			}
 		}
+	}
 
-		// MOUSE WHEEL LOGIC
-		if (const auto* mouseWheel = event->getIf<sf::Event::MouseWheelScrolled>())
+	// MOUSE MOVING
+	if (const auto* mousemoved = event.getIf<sf::Event::MouseMoved>())
+	{
+		if (!m_paused)
 		{
-			if (!m_paused)
-			{
-				if (mouseWheel->delta > 0)
-					m_camera->zoomIn();
-				else
-					m_camera->zoomOut();
-			}
+			auto pixel = mousemoved->position;
+			sf::Vector2f mouseWorldPos = m_window.mapPixelToCoords(pixel, m_camera->getCamera());
+			sf::Vector2f mouseHudPos = m_window.mapPixelToCoords(pixel, m_hud->getCamera());
+
+			m_hud->input(*mousemoved, mouseHudPos);
 		}
 	}
 
+	// MOUSE WHEEL LOGIC
+	if (const auto* mouseWheel = event.getIf<sf::Event::MouseWheelScrolled>())
+	{
+		if (!m_paused)
+		{
+			if (mouseWheel->delta > 0)
+				m_camera->zoomIn();
+			else
+				m_camera->zoomOut();
+		}
+	}
 }
-
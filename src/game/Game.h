@@ -3,6 +3,8 @@
 #include "../entity_manager/EntityManager.h"
 #include "../map_generator/MapGenerator.h"
 #include "../camera/Camera.h"
+#include "../save/SaveGame.h"
+#include "Replay.h"
 
 #include "../hud/Hud.h"
 
@@ -18,6 +20,17 @@ class Game
 	std::unique_ptr<Hud>			m_hud;
 	std::shared_ptr<GameClock>		m_game_clock;
 	std::shared_ptr<MapGenerator>	m_map;
+	std::unique_ptr<SaveGame>		m_save;				// declared after the entity manager, it holds a reference to it
+	std::string						m_save_file;		// saved on F6, loaded on F9
+	std::string						m_trace_file;		// Chrome trace written on F4
+	std::string						m_metrics_file;		// metrics dumped as JSON every m_metrics_interval
+	float							m_metrics_interval{ 10.f };	// seconds
+	float							m_metrics_elapsed{ 0.f };
+
+	// REPLAY
+	Replay							m_replay;
+	bool							m_lockstep{ false };	// workers finish within the frame, results land on the same frame
+	bool							m_headless{ false };	// playing without drawing the entities and the HUD
 
 	sf::Vector2i					m_current_position{ 0, 0 };
 	float							m_deltaTime{ 0.f };
@@ -30,6 +43,7 @@ class Game
 
 	void sMovement();
 	void sUserInput();
+	void handleEvent(const sf::Event& event);
 	void sRender();
 	void sCollision();
 
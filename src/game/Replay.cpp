@@ -0,0 +1,288 @@
+#include <pch.h>
+
+#include <cstring>
+
+#include "Replay.h"
+#include "MappedFile.h"
+
+Replay::Replay() = default;
+Replay::~Replay() = default;
+
+/*
+*	Open the log and write the header. Every frame from now on is appended by endFrame().
+*/
+bool Replay::startRecording(const std::string& file, const std::string& config, int seed)
+{
+	m_out_buffer.resize(1 << 16);
+	m_out.rdbuf()->pubsetbuf(m_out_buffer.data(), static_cast<std::streamsize>(m_out_buffer.size()));
+	m_out.open(file, std::ios::binary | std::ios::trunc);
+
+	if (!m_out)
+	{
+		LOG_ERROR("Could not record the session to {}.", file);
+		return false;
+	}
+
+	Header header;
+	header.seed			= seed;
+	header.config_size	= static_cast<std::uint32_t>(config.size());
+
+	m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_out.write(config.data(), static_cast<std::streamsize>(config.size()));
+
+	m_mode	= Mode::Record;
+	m_file	= file;
+	m_seed	= seed;
+
+	LOG_INFO("Recording the session to {}.", file);
+	return true;
+}
+
+/*
+*	Map a recording and read its header. The config and seed are available through the getters.
+*/
+bool Replay::startPlaying(const std::string& file)
+{
+	m_in = std::make_unique<MappedFile>(file);
+
+	Header header;
+	if (!*m_in || m_in->size() < sizeof(header))
+	{
+		LOG_ERROR("Could not open the recording {}.", file);
+		return false;
+	}
+
+	std::memcpy(&header, m_in->data(), sizeof(header));
+
+	if (header.magic != Header{}.magic || header.version != Header{}.version || m_in->size() - sizeof(header) < header.config_size)
+	{
+		LOG_ERROR("{} is not a recording of this version.", file);
+		return false;
+	}
+
+	m_config.assign(reinterpret_cast<const char*>(m_in->data()) + sizeof(header), header.config_size);
+	m_seed		= header.seed;
+	m_offset	= sizeof(header) + header.config_size;
+	m_mode		= Mode::Play;
+	m_file		= file;
+
+	LOG_INFO("Playing the recording {}.", file);
+	return true;
+}
+
+/*
+*	Start of a frame. Recording keeps the real delta, playing loads the recorded frame and returns its delta.
+*/
+float Replay::beginFrame(std::uint64_t frame, float delta)
+{
+	m_inputs.clear();
+	m_next_value = 0;
+
+	if (m_mode == Mode::Record)
+	{
+		m_frame = FrameRecord{ frame, delta, 0 };
+		return delta;
+	}
+
+	if (m_mode != Mode::Play || m_finished)
+		return delta;
+
+	if (m_in->size() - m_offset < sizeof(FrameRecord))
+	{
+		m_finished = true;
+		return delta;
+	}
+
+	std::memcpy(&m_frame, m_in->data() + m_offset, sizeof(FrameRecord));
+	m_offset += sizeof(FrameRecord);
+
+	if ((m_in->size() - m_offset) / sizeof(InputRecord) < m_frame.inputs)
+	{
+		LOG_WARN("The recording {} is truncated at frame {}.", m_file, m_frame.frame);
+		m_finished = true;
+		return delta;
+	}
+
+	if (m_frame.frame != frame)
+		LOG_WARN_RATE(1000, "Replay out of step, frame {} plays recorded frame {}.", frame, m_frame.frame);
+
+	m_inputs.resize(m_frame.inputs);
+	std::memcpy(m_inputs.data(), m_in->data() + m_offset, m_frame.inputs * sizeof(InputRecord));
+	m_offset += m_frame.inputs * sizeof(InputRecord);
+
+	return m_frame.delta;
+}
+
+/*
+*	End of a frame, recording appends it to the log.
+*/
+void Replay::endFrame()
+{
+	if (m_mode != Mode::Record)
+		return;
+
+	m_frame.inputs = static_cast<std::uint32_t>(m_inputs.size());
+
+	m_out.write(reinterpret_cast<const char*>(&m_frame), sizeof(m_frame));
+	m_out.write(reinterpret_cast<const char*>(m_inputs.data()), static_cast<std::streamsize>(m_inputs.size() * sizeof(InputRecord)));
+}
+
+/*
+*	Add an event handled on this frame. Events the game ignores aren't stored.
+*/
+void Replay::record(const sf::Event& event)
+{
+	if (m_mode != Mode::Record)
+		return;
+
+	if (auto input = encode(event))
+		m_inputs.push_back(*input);
+}
+
+/*
+*	Events recorded on the current frame, in the order they were handled.
+*/
+std::vector<sf::Event> Replay::takeEvents()
+{
+	std::vector<sf::Event> events;
+
+	if (m_mode != Mode::Play)
+		return events;
+
+	for (const auto& input : m_inputs)
+	{
+		if (auto event = decode(input))
+			events.push_back(*event);
+	}
+
+	return events;
+}
+
+/*
+*	A value the game drew at random while handling an input. Recording stores it, playing returns the recorded one.
+*/
+int Replay::value(int value)
+{
+	if (m_mode == Mode::Record)
+	{
+		InputRecord input;
+		input.kind = Kind::Value;
+		input.code = value;
+		m_inputs.push_back(input);
+
+		return value;
+	}
+
+	if (m_mode == Mode::Play)
+	{
+		for (; m_next_value < m_inputs.size(); ++m_next_value)
+		{
+			if (m_inputs[m_next_value].kind == Kind::Value)
+				return m_inputs[m_next_value++].code;
+		}
+
+		LOG_WARN("Frame {} asked for a value that wasn't recorded.", m_frame.frame);
+	}
+
+	return value;
+}
+
+/*
+*	Compact form of the events handled by Game::sUserInput.
+*/
+std::optional<Replay::InputRecord> Replay::encode(const sf::Event& event)
+{
+	InputRecord input;
+
+	if (event.is<sf::Event::Closed>())
+	{
+		input.kind = Kind::Closed;
+	}
+	else if (const auto* pressed = event.getIf<sf::Event::KeyPressed>())
+	{
+		input.kind = Kind::KeyPressed;
+		input.code = static_cast<std::int32_t>(pressed->code);
+	}
+	else if (const auto* released = event.getIf<sf::Event::KeyReleased>())
+	{
+		input.kind = Kind::KeyReleased;
+		input.code = static_cast<std::int32_t>(released->code);
+	}
+	else if (const auto* text = event.getIf<sf::Event::TextEntered>())
+	{
+		input.kind = Kind::TextEntered;
+		input.code = static_cast<std::int32_t>(text->unicode);
+	}
+	else if (const auto* button_pressed = event.getIf<sf::Event::MouseButtonPressed>())
+	{
+		input.kind		= Kind::MouseButtonPressed;
+		input.button	= static_cast<std::uint8_t>(button_pressed->button);
+		input.x			= button_pressed->position.x;
+		input.y			= button_pressed->position.y;
+	}
+	else if (const auto* button_released = event.getIf<sf::Event::MouseButtonReleased>())
+	{
+		input.kind		= Kind::MouseButtonReleased;
+		input.button	= static_cast<std::uint8_t>(button_released->button);
+		input.x			= button_released->position.x;
+		input.y			= button_released->position.y;
+	}
+	else if (const auto* moved = event.getIf<sf::Event::MouseMoved>())
+	{
+		input.kind	= Kind::MouseMoved;
+		input.x		= moved->position.x;
+		input.y		= moved->position.y;
+	}
+	else if (const auto* wheel = event.getIf<sf::Event::MouseWheelScrolled>())
+	{
+		input.kind		= Kind::MouseWheelScrolled;
+		input.button	= static_cast<std::uint8_t>(wheel->wheel);
+		input.delta		= wheel->delta;
+		input.x			= wheel->position.x;
+		input.y			= wheel->position.y;
+	}
+	else
+	{
+		return std::nullopt;
+	}
+
+	return input;
+}
+
+/*
+*	Event back from its compact form. Values aren't events.
+*/
+std::optional<sf::Event> Replay::decode(const InputRecord& input)
+{
+	sf::Vector2i position{ input.x, input.y };
+
+	switch (input.kind)
+	{
+	case Kind::Closed:
+		return sf::Event{ sf::Event::Closed{} };
+	case Kind::KeyPressed:
+	{
+		sf::Event::KeyPressed key{};
+		key.code = static_cast<sf::Keyboard::Key>(input.code);
+		return sf::Event{ key };
+	}
+	case Kind::KeyReleased:
+	{
+		sf::Event::KeyReleased key{};
+		key.code = static_cast<sf::Keyboard::Key>(input.code);
+		return sf::Event{ key };
+	}
+	case Kind::TextEntered:
+		return sf::Event{ sf::Event::TextEntered{ static_cast<char32_t>(input.code) } };
+	case Kind::MouseButtonPressed:
+		return sf::Event{ sf::Event::MouseButtonPressed{ static_cast<sf::Mouse::Button>(input.button), position } };
+	case Kind::MouseButtonReleased:
+		return sf::Event{ sf::Event::MouseButtonReleased{ static_cast<sf::Mouse::Button>(input.button), position } };
+	case Kind::MouseMoved:
+		return sf::Event{ sf::Event::MouseMoved{ position } };
+	case Kind::MouseWheelScrolled:
+		return sf::Event{ sf::Event::MouseWheelScrolled{ static_cast<sf::Mouse::Wheel>(input.button), input.delta, position } };
+	default:
+		return std::nullopt;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+class MappedFile;
+
+// SESSION RECORDING
+// The config, the starting seed, then for every frame its delta and the input events handled on it. Playing a
+// recording feeds the same deltas and events on the same frame numbers. Values the game draws at random in response
+// to an input (a new seed) are recorded too, see value().
+//
+// File layout (little endian): Header, the config text, then a FrameRecord per frame followed by its InputRecords.
+class Replay
+{
+public:
+	enum class Mode
+	{
+		Off,
+		Record,
+		Play
+	};
+
+private:
+	enum class Kind : std::uint8_t
+	{
+		Closed,
+		KeyPressed,
+		KeyReleased,
+		TextEntered,
+		MouseButtonPressed,
+		MouseButtonReleased,
+		MouseMoved,
+		MouseWheelScrolled,
+		Value
+	};
+
+	struct Header {
+		std::array<char, 4>	magic{ 'O', 'O', 'T', 'R' };
+		std::uint32_t		version{ 1 };
+		std::int32_t		seed{ 0 };
+		std::uint32_t		config_size{ 0 };
+	};
+
+	struct FrameRecord {
+		std::uint64_t	frame{ 0 };
+		float			delta{ 0.f };		// seconds
+		std::uint32_t	inputs{ 0 };
+	};
+
+	struct InputRecord {
+		Kind			kind{ Kind::Closed };
+		std::uint8_t	button{ 0 };		// mouse button or wheel
+		std::uint16_t	reserved{ 0 };
+		std::int32_t	code{ 0 };			// key, character or recorded value
+		std::int32_t	x{ 0 };				// mouse position in window px
+		std::int32_t	y{ 0 };
+		float			delta{ 0.f };		// wheel
+	};
+
+	Mode						m_mode{ Mode::Off };
+	std::string					m_file;
+
+	// RECORD variables
+	std::ofstream				m_out;
+	std::vector<char>			m_out_buffer;
+
+	// PLAY variables
+	std::unique_ptr<MappedFile>	m_in;
+	std::size_t					m_offset{ 0 };
+	std::string					m_config;
+	int							m_seed{ 0 };
+
+	// CURRENT FRAME
+	FrameRecord					m_frame;
+	std::vector<InputRecord>	m_inputs;
+	std::size_t					m_next_value{ 0 };		// next Value input handed out by value()
+	bool						m_finished{ false };
+
+	static std::optional<InputRecord>	encode(const sf::Event& event);
+	static std::optional<sf::Event>		decode(const InputRecord& input);
+
+public:
+
+	// CONSTRUCTOR
+	Replay();
+	~Replay();
+	Replay(const Replay&) = delete;
+	Replay& operator=(const Replay&) = delete;
+
+	// MAIN FUNCTIONS
+	bool					startRecording(const std::string& file, const std::string& config, int seed);
+	bool					startPlaying(const std::string& file);
+	float					beginFrame(std::uint64_t frame, float delta);
+	void					endFrame();
+	void					record(const sf::Event& event);
+	std::vector<sf::Event>	takeEvents();
+	int						value(int value);
+
+	// GETTERS
+	Mode					getMode()		const	{ return m_mode; }
+	bool					isPlaying()		const	{ return m_mode == Mode::Play; }
+	bool					isFinished()	const	{ return m_finished; }
+	const std::string&		getConfig()		const	{ return m_config; }
+	int						getSeed()		const	{ return m_seed; }
+};
@@ -22,6 +22,13 @@ public:
     // SETTERS
     void setTimeScale(float scale) { m_timeScale = scale; }
     void pause(bool p) { m_paused = p; }
+    // Jump to a time, in minutes from the beginning of the simulation (loading a save)
+    void setTimestamp(std::int64_t minutes) {
+        m_days = static_cast<int>(minutes / (24 * 60));
+        m_hour = static_cast<int>(minutes / 60 % 24);
+        m_minute = static_cast<int>(minutes % 60);
+        m_accumulator = 0.0f;
+    }
 
     // GETTERS
     int getHour() const { return m_hour; }
@@ -1,12 +1,31 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
 #include <spdlog/spdlog.h>
+#include <spdlog/async.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/basic_file_sink.h>
 
+// Levels for LOG_ACTIVE_LEVEL, set by the LOG_LEVEL CMake option. Macros below it compile to nothing
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF   4
+
+#ifndef LOG_ACTIVE_LEVEL
+#define LOG_ACTIVE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
 class Logger {
 public:
-    static void init(const std::string& file = "logs/game.log") {
+    // Async mode formats and writes on a background thread. The queue is bounded, when it is full the oldest
+    // messages are dropped instead of blocking the caller.
+    static void init(const std::string& file = "logs/game.log", const std::string& level = "debug", bool async = true, std::size_t queue_size = 8192) {
         auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
         console_sink->set_pattern("[%T] [%^%l%$] [%s:%#] %v");
 
@@ -14,16 +33,77 @@ public:
         file_sink->set_pattern("[%T] [%l] [%s:%#] %v");
 
         std::vector<spdlog::sink_ptr> sinks{ console_sink, file_sink };
-        auto logger = std::make_shared<spdlog::logger>("multi_sink", sinks.begin(), sinks.end());
+        std::shared_ptr<spdlog::logger> logger;
+
+        if (async)
+        {
+            spdlog::init_thread_pool(queue_size, 1);
+            logger = std::make_shared<spdlog::async_logger>("multi_sink", sinks.begin(), sinks.end(), spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+        }
+        else
+        {
+            logger = std::make_shared<spdlog::logger>("multi_sink", sinks.begin(), sinks.end());
+        }
 
         spdlog::set_default_logger(logger);
-        spdlog::set_level(spdlog::level::debug);
-        spdlog::flush_on(spdlog::level::info);
+        spdlog::set_level(spdlog::level::from_str(level));
+        spdlog::flush_on(spdlog::level::warn);
+        spdlog::flush_every(std::chrono::seconds(1));
+    }
+
+    // Write what is still queued, call before exiting
+    static void shutdown() {
+        spdlog::shutdown();
+    }
+
+    // True at most once per interval for a call site, used by the rate limited macros
+    static bool allow(std::atomic<std::int64_t>& last, std::int64_t interval_ms) {
+        std::int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        std::int64_t previous = last.load(std::memory_order_relaxed);
+
+        return now - previous >= interval_ms && last.compare_exchange_strong(previous, now, std::memory_order_relaxed);
     }
 };
 
+#define LOG_CALL(level, ...) spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __FUNCTION__}, level, __VA_ARGS__)
+
+// Compiled out, the arguments are still checked and count as used but never evaluated
+#define LOG_NONE(...) do { if (false) LOG_CALL(spdlog::level::off, __VA_ARGS__); } while (0)
+
+// Only the first message of every interval (ms) is logged from a call site
+#define LOG_RATE(interval_ms, level, ...) \
+    do { \
+        static std::atomic<std::int64_t> log_rate_last{ std::numeric_limits<std::int64_t>::min() / 2 }; \
+        if (Logger::allow(log_rate_last, interval_ms)) LOG_CALL(level, __VA_ARGS__); \
+    } while (0)
+
 // Macros with source location support
-#define LOG_INFO(...)  spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __FUNCTION__}, spdlog::level::info, __VA_ARGS__)
-#define LOG_WARN(...)  spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __FUNCTION__}, spdlog::level::warn, __VA_ARGS__)
-#define LOG_ERROR(...) spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __FUNCTION__}, spdlog::level::err, __VA_ARGS__)
-#define LOG_DEBUG(...) spdlog::log(spdlog::source_loc{__FILE__, __LINE__, __FUNCTION__}, spdlog::level::debug, __VA_ARGS__)
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_CALL(spdlog::level::debug, __VA_ARGS__)
+#define LOG_DEBUG_RATE(interval_ms, ...) LOG_RATE(interval_ms, spdlog::level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_NONE(__VA_ARGS__)
+#define LOG_DEBUG_RATE(interval_ms, ...) LOG_NONE(__VA_ARGS__)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...)  LOG_CALL(spdlog::level::info, __VA_ARGS__)
+#define LOG_INFO_RATE(interval_ms, ...) LOG_RATE(interval_ms, spdlog::level::info, __VA_ARGS__)
+#else
+#define LOG_INFO(...)  LOG_NONE(__VA_ARGS__)
+#define LOG_INFO_RATE(interval_ms, ...) LOG_NONE(__VA_ARGS__)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...)  LOG_CALL(spdlog::level::warn, __VA_ARGS__)
+#define LOG_WARN_RATE(interval_ms, ...) LOG_RATE(interval_ms, spdlog::level::warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...)  LOG_NONE(__VA_ARGS__)
+#define LOG_WARN_RATE(interval_ms, ...) LOG_NONE(__VA_ARGS__)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_CALL(spdlog::level::err, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_NONE(__VA_ARGS__)
+#endif
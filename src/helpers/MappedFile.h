@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// READ ONLY MEMORY MAPPED FILE
+// The whole file is mapped on construction and unmapped on destruction, pages are read by the OS on first access.
+//
+// Sample call: MappedFile file{ "saves/world.sav" }; if (file) parse(file.data(), file.size());
+class MappedFile
+{
+    const std::uint8_t* m_data{ nullptr };
+    std::size_t         m_size{ 0 };
+
+#ifdef _WIN32
+    HANDLE              m_file{ INVALID_HANDLE_VALUE };
+    HANDLE              m_mapping{ nullptr };
+#endif
+
+public:
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+            return;
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping)
+            return;
+
+        m_data = static_cast<const std::uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data)
+            m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const std::uint8_t*>(data);
+                m_size = static_cast<std::size_t>(info.st_size);
+                ::madvise(data, m_size, MADV_SEQUENTIAL);
+            }
+        }
+
+        // The mapping stays valid once the descriptor is closed
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#else
+        if (m_data)
+            ::munmap(const_cast<std::uint8_t*>(m_data), m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    explicit operator bool() const { return m_data != nullptr; }
+
+    const std::uint8_t* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// RUNTIME METRICS
+// Named counters, gauges and latency histograms that live for the whole run. Updating one is a relaxed atomic
+// operation, the mutex is only taken to register a name and to read everything back (HUD panel, JSON dump).
+// Registered metrics are never removed, keep the reference in a static at the call site.
+//
+// Sample call: static auto& evicted = Metrics::get().counter("map.chunks_evicted"); evicted.add();
+// Sample call: Metrics::get().gauge("entities.alive").set(count);
+// Sample call: static auto& latency = Metrics::get().histogram("map.chunk_latency_ms"); latency.observe(ms);
+class Metrics
+{
+public:
+    // Only goes up
+    class Counter
+    {
+        std::atomic<std::uint64_t> m_value{ 0 };
+
+    public:
+        void add(std::uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+        std::uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+    };
+
+    // Last value set, e.g. a queue depth
+    class Gauge
+    {
+        std::atomic<std::int64_t> m_value{ 0 };
+
+    public:
+        void set(std::int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+        void add(std::int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+        std::int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+    };
+
+    // Samples counted in fixed buckets (ms), percentiles are the upper bound of the bucket they fall in
+    class Histogram
+    {
+        std::vector<float>                              m_bounds;       // upper bound of every bucket but the last
+        std::unique_ptr<std::atomic<std::uint64_t>[]>   m_buckets;      // one more than bounds, for the overflow
+        std::atomic<std::uint64_t>                      m_count{ 0 };
+        std::atomic<std::uint64_t>                      m_sum_us{ 0 };
+
+    public:
+        explicit Histogram(std::vector<float> bounds)
+            : m_bounds(std::move(bounds)), m_buckets(new std::atomic<std::uint64_t>[m_bounds.size() + 1])
+        {
+            for (std::size_t i = 0; i <= m_bounds.size(); ++i)
+                m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+
+        void observe(float ms)
+        {
+            std::size_t bucket = std::upper_bound(m_bounds.begin(), m_bounds.end(), ms) - m_bounds.begin();
+
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_sum_us.fetch_add(static_cast<std::uint64_t>(std::max(ms, 0.f) * 1000.f), std::memory_order_relaxed);
+        }
+
+        std::uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+        float mean() const
+        {
+            std::uint64_t n = count();
+            return n == 0 ? 0.f : static_cast<float>(m_sum_us.load(std::memory_order_relaxed)) / 1000.f / static_cast<float>(n);
+        }
+
+        // Upper bound of the bucket holding the percentile, infinity when it is the overflow bucket
+        float percentile(float p) const
+        {
+            std::vector<std::uint64_t> counts = buckets();
+
+            std::uint64_t total = 0;
+            for (auto c : counts)
+                total += c;
+
+            if (total == 0)
+                return 0.f;
+
+            std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(p * static_cast<float>(total)));
+            std::uint64_t seen = 0;
+
+            for (std::size_t i = 0; i < m_bounds.size(); ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                    return m_bounds[i];
+            }
+
+            return std::numeric_limits<float>::infinity();
+        }
+
+        const std::vector<float>& bounds() const { return m_bounds; }
+
+        std::vector<std::uint64_t> buckets() const
+        {
+            std::vector<std::uint64_t> counts(m_bounds.size() + 1);
+            for (std::size_t i = 0; i < counts.size(); ++i)
+                counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+
+            return counts;
+        }
+    };
+
+    // One metric formatted for display
+    struct Line {
+        std::string name;
+        std::string value;
+    };
+
+    static Metrics& get()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    Counter& counter(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& slot = m_counters[name];
+        if (!slot)
+            slot = std::make_unique<Counter>();
+
+        return *slot;
+    }
+
+    Gauge& gauge(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& slot = m_gauges[name];
+        if (!slot)
+            slot = std::make_unique<Gauge>();
+
+        return *slot;
+    }
+
+    // Bounds are only used the first time a name is registered. The default suits latencies from 1 ms to a few seconds
+    Histogram& histogram(const std::string& name, std::vector<float> bounds = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 })
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& slot = m_histograms[name];
+        if (!slot)
+            slot = std::make_unique<Histogram>(std::move(bounds));
+
+        return *slot;
+    }
+
+    // Every metric, sorted by name
+    nlohmann::json toJson() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        nlohmann::json js;
+        js["uptime_s"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+
+        js["counters"] = nlohmann::json::object();
+        for (const auto& [name, counter] : m_counters)
+            js["counters"][name] = counter->value();
+
+        js["gauges"] = nlohmann::json::object();
+        for (const auto& [name, gauge] : m_gauges)
+            js["gauges"][name] = gauge->value();
+
+        js["histograms"] = nlohmann::json::object();
+        for (const auto& [name, histogram] : m_histograms)
+        {
+            auto& h = js["histograms"][name];
+            h["count"]      = histogram->count();
+            h["mean"]       = histogram->mean();
+            h["p50"]        = histogram->percentile(0.5f);
+            h["p99"]        = histogram->percentile(0.99f);
+            h["bounds"]     = histogram->bounds();
+            h["buckets"]    = histogram->buckets();
+        }
+
+        return js;
+    }
+
+    // Overwrites the file with the current values. Returns false if the file can't be opened.
+    bool dump(const std::string& file) const
+    {
+        std::ofstream out(file);
+        if (!out)
+            return false;
+
+        out << toJson().dump(2) << '\n';
+        return true;
+    }
+
+    // Counters, gauges then histograms, for the HUD
+    std::vector<Line> getLines() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<Line> lines;
+        lines.reserve(m_counters.size() + m_gauges.size() + m_histograms.size());
+
+        char buffer[64];
+
+        for (const auto& [name, counter] : m_counters)
+            lines.push_back(Line{ name, std::to_string(counter->value()) });
+
+        for (const auto& [name, gauge] : m_gauges)
+            lines.push_back(Line{ name, std::to_string(gauge->value()) });
+
+        for (const auto& [name, histogram] : m_histograms)
+        {
+            std::snprintf(buffer, sizeof(buffer), "n %llu avg %.1f p99 %.0f", static_cast<unsigned long long>(histogram->count()),
+                histogram->mean(), histogram->percentile(0.99f));
+            lines.push_back(Line{ name, buffer });
+        }
+
+        return lines;
+    }
+
+private:
+    mutable std::mutex                                  m_mutex;
+    std::map<std::string, std::unique_ptr<Counter>>     m_counters;
+    std::map<std::string, std::unique_ptr<Gauge>>       m_gauges;
+    std::map<std::string, std::unique_ptr<Histogram>>   m_histograms;
+    std::chrono::steady_clock::time_point               m_start{ std::chrono::steady_clock::now() };
+
+    Metrics() = default;
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Trace.h"
+
+// FRAME PROFILER
+// Scoped timers grouped by section name, kept over a rolling window of frames.
+// Timers can run on any thread, their time lands in the frame they finish in.
+// Recording never locks or allocates: every thread adds to its own slots, keyed by the name pointer, and endFrame()
+// merges them under the mutex. Names must be string literals, like the trace.
+//
+// Sample call: PROFILE_SCOPE("Map/Render");
+// Sample call: Profiler::Timer timer{ "Entities/Tiers" }; ... timer.next("Entities/Perception");
+class Profiler
+{
+public:
+    static constexpr std::size_t Window = 240;     // frames kept for the averages and graphs
+
+    struct Stats {
+        std::string name;
+        float       last{ 0.f };        // ms in the last frame
+        float       average{ 0.f };     // ms over the window
+        float       p99{ 0.f };         // ms, 99th percentile over the window
+        std::size_t calls{ 0 };         // timers finished in the last frame
+    };
+
+    // Times from construction to destruction, or to the next call of next(). Also recorded on the trace timeline
+    class Timer
+    {
+        const char*     m_name;
+        std::uint64_t   m_start;        // us, trace clock
+
+    public:
+        explicit Timer(const char* name)
+            : m_name(name), m_start(Trace::get().now())
+        {}
+
+        ~Timer() { stop(); }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        // End the current section and start timing another one
+        void next(const char* name)
+        {
+            m_start = stop();
+            m_name = name;
+        }
+
+    private:
+        std::uint64_t stop()
+        {
+            std::uint64_t end = Trace::get().now();
+
+            Trace::get().complete(m_name, m_start, end);
+            Profiler::get().record(m_name, end - m_start);
+
+            return end;
+        }
+    };
+
+    static Profiler& get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // Add a finished timer to the calling thread's slot of that name
+    void record(const char* name, std::uint64_t us)
+    {
+        Buffer& buffer = local();
+        std::size_t count = buffer.count.load(std::memory_order_relaxed);
+
+        // Few sections run on a thread, a linear scan beats hashing
+        Slot* slot = nullptr;
+        for (std::size_t i = 0; i < count && !slot; ++i)
+        {
+            if (buffer.slots[i].name == name)
+                slot = &buffer.slots[i];
+        }
+
+        if (!slot)
+        {
+            if (count == Buffer::Capacity)
+                return;
+
+            slot = &buffer.slots[count];
+            slot->name = name;
+            buffer.count.store(count + 1, std::memory_order_release);
+        }
+
+        slot->us.fetch_add(us, std::memory_order_relaxed);
+        slot->calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Close the frame, every section gets a sample even if it didn't run
+    void endFrame(float frame_ms)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_frames[m_cursor] = frame_ms;
+
+        // Collect what the threads recorded since the last frame
+        for (const auto& buffer : m_buffers)
+        {
+            std::size_t count = buffer->count.load(std::memory_order_acquire);
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                Slot& slot = buffer->slots[i];
+                std::uint64_t us = slot.us.exchange(0, std::memory_order_relaxed);
+                std::uint64_t calls = slot.calls.exchange(0, std::memory_order_relaxed);
+
+                Section& section = m_sections[sectionOf(slot.name)];
+                section.current += static_cast<float>(us) / 1000.f;
+                section.current_calls += static_cast<std::size_t>(calls);
+            }
+        }
+
+        for (auto& section : m_sections)
+        {
+            section.samples[m_cursor] = section.current;
+            section.calls = section.current_calls;
+            section.current = 0.f;
+            section.current_calls = 0;
+        }
+
+        m_cursor = (m_cursor + 1) % Window;
+        m_filled = std::min(m_filled + 1, Window);
+    }
+
+    // Averages and percentiles, sorted by name so the panel doesn't jump around
+    std::vector<Stats> getStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<Stats> stats;
+        stats.reserve(m_sections.size());
+
+        std::vector<float> sorted;
+        std::size_t last = (m_cursor + Window - 1) % Window;
+
+        for (const auto& section : m_sections)
+        {
+            Stats s{ section.name };
+            s.last = section.samples[last];
+            s.calls = section.calls;
+
+            if (m_filled > 0)
+            {
+                sorted.assign(section.samples.begin(), section.samples.begin() + m_filled);
+                for (float sample : sorted)
+                    s.average += sample;
+                s.average /= static_cast<float>(m_filled);
+
+                std::size_t rank = (m_filled * 99) / 100;
+                std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+                s.p99 = sorted[rank];
+            }
+
+            stats.push_back(std::move(s));
+        }
+
+        std::sort(stats.begin(), stats.end(), [](const Stats& a, const Stats& b) { return a.name < b.name; });
+
+        return stats;
+    }
+
+    // Frame times (ms), oldest first
+    std::vector<float> getFrameTimes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<float> frames;
+        frames.reserve(m_filled);
+
+        std::size_t first = (m_cursor + Window - m_filled) % Window;
+        for (std::size_t i = 0; i < m_filled; ++i)
+            frames.push_back(m_frames[(first + i) % Window]);
+
+        return frames;
+    }
+
+private:
+    struct Section {
+        std::string                 name;
+        std::array<float, Window>   samples{};
+        float                       current{ 0.f };
+        std::size_t                 current_calls{ 0 };
+        std::size_t                 calls{ 0 };
+    };
+
+    // Time a thread spent in one section since the last frame. Only the owner thread adds, endFrame() takes it
+    struct Slot {
+        const char*                 name{ nullptr };
+        std::atomic<std::uint64_t>  us{ 0 };
+        std::atomic<std::uint64_t>  calls{ 0 };
+    };
+
+    struct Buffer {
+        static constexpr std::size_t Capacity = 64;    // sections per thread, more are dropped
+
+        std::array<Slot, Capacity>  slots;
+        std::atomic<std::size_t>    count{ 0 };         // slots in use, only the owner thread adds
+    };
+
+    mutable std::mutex                                  m_mutex;
+    std::vector<Section>                                m_sections;
+    std::unordered_map<const char*, std::size_t>        m_index;        // name pointer to section
+    std::unordered_map<std::string, std::size_t>        m_names;        // the same name can have several pointers
+    std::vector<std::unique_ptr<Buffer>>                m_buffers;
+    std::array<float, Window>                           m_frames{};
+    std::size_t                                         m_cursor{ 0 };
+    std::size_t                                         m_filled{ 0 };
+
+    Profiler() = default;
+
+    // Buffers live as long as the process, like the trace ones
+    Buffer& local()
+    {
+        thread_local Buffer* buffer = nullptr;
+
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_buffers.push_back(std::make_unique<Buffer>());
+            buffer = m_buffers.back().get();
+        }
+
+        return *buffer;
+    }
+
+    // Section of a name, the string is only built the first time a pointer shows up. Called with the mutex held
+    std::size_t sectionOf(const char* name)
+    {
+        auto it = m_index.find(name);
+        if (it != m_index.end())
+            return it->second;
+
+        auto named = m_names.find(name);
+        if (named == m_names.end())
+        {
+            named = m_names.emplace(name, m_sections.size()).first;
+            m_sections.push_back(Section{ name });
+        }
+
+        m_index.emplace(name, named->second);
+        return named->second;
+    }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Time the rest of the enclosing scope
+#define PROFILE_SCOPE(name) Profiler::Timer PROFILE_CONCAT(profile_timer_, __LINE__){ name }
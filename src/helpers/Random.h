@@ -2,32 +2,89 @@
 #define RANDOM_MT_H
 
 #include <chrono>
+#include <cstdint>
 #include <random>
 
-// This header-only Random namespace implements a self-seeding Mersenne Twister.
+// This header-only Random namespace started from the self-seeding Mersenne Twister of learncpp.com
+// (https://www.learncpp.com/cpp-tutorial/global-random-numbers-random-h/).
 // Requires C++17 or newer.
 // It can be #included into as many code files as needed (The inline keyword avoids ODR violations)
-// Freely redistributable, courtesy of learncpp.com (https://www.learncpp.com/cpp-tutorial/global-random-numbers-random-h/)
+//
+// Two kinds of generators are provided:
+// * Random::get        -> per-thread xoshiro256**, seeded from the clock. For things that don't need to be replayed.
+// * Random::Stream     -> counter-based, keyed by world seed, stream (entity) and counter (tick).
+//                         Same keys always give the same numbers, on any thread and in any order.
 namespace Random
 {
-	// Returns a seeded Mersenne Twister
-	// Note: we'd prefer to return a std::seed_seq (to initialize a std::mt19937), but std::seed can't be copied, so it can't be returned by value.
-	// Instead, we'll create a std::mt19937, seed it, and then return the std::mt19937 (which can be copied).
-	inline std::mt19937 generate()
+	// SplitMix64 finalizer, turns any 64 bit value into a well mixed one.
+	constexpr std::uint64_t mix(std::uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// Map a 64 bit draw to [min, max] (inclusive) without division (Lemire's multiply-shift).
+	inline int toRange(std::uint64_t draw, int min, int max)
+	{
+		if (max <= min)
+			return min;
+
+		std::uint64_t range = static_cast<std::uint64_t>(static_cast<std::int64_t>(max) - min) + 1;
+		return static_cast<int>(min + static_cast<std::int64_t>(((draw >> 32) * range) >> 32));
+	}
+
+	// xoshiro256** by Blackman and Vigna. Small state, very fast, satisfies UniformRandomBitGenerator.
+	class Xoshiro256
+	{
+		std::uint64_t s[4];
+
+		static constexpr std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+	public:
+		using result_type = std::uint64_t;
+
+		explicit Xoshiro256(std::uint64_t seed)
+		{
+			for (auto& state : s)
+				state = seed = mix(seed);
+		}
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return ~result_type{ 0 }; }
+
+		result_type operator()()
+		{
+			const std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+			const std::uint64_t t = s[1] << 17;
+
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+
+			return result;
+		}
+	};
+
+	// Returns a seed made of the clock and std::random_device
+	inline std::uint64_t generate()
 	{
 		std::random_device rd{};
 
-		// Create seed_seq with clock and 7 random numbers from std::random_device
-		std::seed_seq ss{
-			static_cast<std::seed_seq::result_type>(std::chrono::steady_clock::now().time_since_epoch().count()),
-				rd(), rd(), rd(), rd(), rd(), rd(), rd() };
+		std::uint64_t seed = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		for (int i = 0; i < 4; ++i)
+			seed = mix(seed ^ rd());
 
-		return std::mt19937{ ss };
+		return seed;
 	}
 
-	// Here's our global std::mt19937 object.
-	// The inline keyword means we only have one global instance for our whole program.
-	inline std::mt19937 mt{ generate() }; // generates a seeded std::mt19937 and copies it into our global object
+	// Here's our generator.
+	// thread_local gives every thread its own instance, so drawing never needs a lock.
+	inline thread_local Xoshiro256 mt{ generate() };
 
 	// Generate a random int between [min, max] (inclusive)
 		// * also handles cases where the two arguments have different types but can be converted to int
@@ -67,6 +124,37 @@ namespace Random
 	{
 		return get<R>(static_cast<R>(min), static_cast<R>(max));
 	}
+
+	// Purposes keep streams with the same seed, entity and tick independent from each other
+	enum class Purpose : std::uint64_t
+	{
+		Generic = 0,
+		Personality,
+		Wander,
+		Path,
+	};
+
+	// Counter-based generator for the simulation.
+	// The n-th draw is mix(key + n), there is no hidden state shared between threads.
+	// Sample call: Random::Stream rng{ world_seed, entity_id, tick, Random::Purpose::Wander };
+	class Stream
+	{
+		std::uint64_t m_key;
+		std::uint64_t m_counter{ 0 };
+
+	public:
+		Stream(std::uint64_t seed, std::uint64_t stream, std::uint64_t counter, Purpose purpose = Purpose::Generic)
+			: m_key(mix(mix(mix(seed) ^ stream) ^ counter) ^ static_cast<std::uint64_t>(purpose))
+		{}
+
+		std::uint64_t next() { return mix(m_key + 0x9E3779B97F4A7C15ull * ++m_counter); }
+
+		// Random int between [min, max] (inclusive)
+		int get(int min, int max) { return toRange(next(), min, max); }
+
+		// Random float between [0, 1)
+		float getFloat() { return static_cast<float>(next() >> 40) * (1.f / 16777216.f); }
+	};
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -29,13 +29,13 @@ public:
         return std::find(container.begin(), container.end(), data) != container.end();
     }
 
-    bool containsPosition(sf::Vector2i& pos)
+    bool containsCoord(sf::Vector2i& coord)
     {
         std::lock_guard<std::mutex> lock(mtx);
 
         for (auto& chunk : container)
         {
-            if (chunk->position == pos)
+            if (chunk->coord == coord)
                 return true;
         }
         
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// TRACE RECORDER
+// Timestamped events kept in a ring buffer per thread, exported as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+// Writing an event never locks: every thread owns its buffer, the mutex is only taken the first time a thread records
+// and when exporting. Names must be string literals, only the pointer is stored.
+//
+// Exporting copies the rings while their owners keep writing. Event fields are atomics and a buffer counts the writes
+// begun as well as the ones finished, like a seqlock: events whose slot was reused during the copy are dropped.
+//
+// Profiler timers record here too, so PROFILE_SCOPE sections show on the timeline.
+class Trace
+{
+public:
+    static constexpr std::size_t Capacity = 1 << 15;   // events kept per thread
+
+    static Trace& get()
+    {
+        static Trace trace;
+        return trace;
+    }
+
+    // Microseconds since the trace started
+    std::uint64_t now() const
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_epoch).count());
+    }
+
+    void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Name shown for the calling thread
+    void setThreadName(const std::string& name)
+    {
+        Buffer& buffer = local();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        buffer.name = name;
+    }
+
+    // Span on the calling thread
+    void complete(const char* name, std::uint64_t start, std::uint64_t end)
+    {
+        push(Event{ name, start, end - start, 0, 'X' });
+    }
+
+    // Span that isn't tied to a thread, e.g. the time a task waited in a queue
+    void async(const char* name, std::uint64_t id, std::uint64_t start, std::uint64_t end)
+    {
+        push(Event{ name, start, 0, id, 'b' });
+        push(Event{ name, end, 0, id, 'e' });
+    }
+
+    // Copy the buffered events and write them as Chrome trace JSON in the background. done is called from the writer
+    // thread, with false if the file can't be opened. Returns false if the previous trace is still being written.
+    bool flush(const std::string& file, std::function<void(bool)> done)
+    {
+        if (m_writing.exchange(true))
+            return false;
+
+        // The previous writer has finished, only its thread is left to reclaim
+        if (m_writer.joinable())
+            m_writer.join();
+
+        m_writer = std::thread([this, threads = copy(), file, done = std::move(done)]
+        {
+            std::uint64_t start = now();
+            bool written = write(threads, file);
+            complete("Trace/Write (writer)", start, now());
+
+            done(written);
+            m_writing = false;
+        });
+
+        return true;
+    }
+
+    ~Trace()
+    {
+        // A trace being written is finished, not dropped
+        if (m_writer.joinable())
+            m_writer.join();
+    }
+
+private:
+    struct Event {
+        const char*     name;
+        std::uint64_t   start;          // us
+        std::uint64_t   duration;       // us, complete events
+        std::uint64_t   id;             // async events
+        char            phase;
+    };
+
+    // Event as stored in a ring, read by the exporter while the owner writes
+    struct Slot {
+        std::atomic<const char*>    name{ nullptr };
+        std::atomic<std::uint64_t>  start{ 0 };
+        std::atomic<std::uint64_t>  duration{ 0 };
+        std::atomic<std::uint64_t>  id{ 0 };
+        std::atomic<char>           phase{ 0 };
+    };
+
+    struct Buffer {
+        std::uint32_t               tid;
+        std::string                 name;
+        std::unique_ptr<Slot[]>     slots{ new Slot[Capacity] };
+        std::atomic<std::uint64_t>  begun{ 0 };    // events whose write has started, only the owner thread writes
+        std::atomic<std::uint64_t>  head{ 0 };     // events ever written
+    };
+
+    // Copy of a buffer, owned by the writer
+    struct Thread {
+        std::uint32_t       tid;
+        std::string         name;
+        std::vector<Event>  events;
+    };
+
+    std::chrono::steady_clock::time_point   m_epoch{ std::chrono::steady_clock::now() };
+    std::atomic<bool>                       m_enabled{ true };
+    mutable std::mutex                      m_mutex;
+    std::vector<std::unique_ptr<Buffer>>    m_buffers;
+
+    std::atomic<bool>                       m_writing{ false };
+    std::thread                             m_writer;
+
+    Trace() = default;
+
+    // Events still held by every buffer, oldest first
+    std::vector<Thread> copy() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<Thread> threads;
+        threads.reserve(m_buffers.size());
+
+        for (const auto& buffer : m_buffers)
+        {
+            Thread& thread = threads.emplace_back(Thread{ buffer->tid, buffer->name, {} });
+
+            std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+            std::uint64_t begin = head > Capacity ? head - Capacity : 0;
+            thread.events.reserve(head - begin);
+
+            for (std::uint64_t i = begin; i < head; ++i)
+            {
+                const Slot& slot = buffer->slots[i % Capacity];
+                thread.events.push_back(Event{
+                    slot.name.load(std::memory_order_relaxed),
+                    slot.start.load(std::memory_order_relaxed),
+                    slot.duration.load(std::memory_order_relaxed),
+                    slot.id.load(std::memory_order_relaxed),
+                    slot.phase.load(std::memory_order_relaxed) });
+            }
+
+            // A field written by a newer event is seen along with the begun count of that event
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t begun = buffer->begun.load(std::memory_order_relaxed);
+            std::uint64_t safe = begun > Capacity ? begun - Capacity : 0;
+
+            if (safe > begin)
+                thread.events.erase(thread.events.begin(), thread.events.begin() + static_cast<std::ptrdiff_t>(std::min(safe, head) - begin));
+        }
+
+        return threads;
+    }
+
+    static bool write(const std::vector<Thread>& threads, const std::string& file)
+    {
+        std::ofstream out(file);
+        if (!out)
+            return false;
+
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+
+        for (const auto& thread : threads)
+        {
+            out << (first ? "" : ",\n")
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.tid
+                << ",\"args\":{\"name\":\"" << thread.name << "\"}}";
+            first = false;
+
+            for (const Event& e : thread.events)
+            {
+                out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"engine\",\"ph\":\"" << e.phase
+                    << "\",\"ts\":" << e.start << ",\"pid\":1,\"tid\":" << thread.tid;
+
+                if (e.phase == 'X')
+                    out << ",\"dur\":" << e.duration;
+                else
+                    out << ",\"id\":" << e.id;
+
+                out << "}";
+            }
+        }
+
+        out << "\n]}\n";
+        return true;
+    }
+
+    // Buffers live as long as the process, threads that exit keep their events
+    Buffer& local()
+    {
+        thread_local Buffer* buffer = nullptr;
+
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_buffers.push_back(std::make_unique<Buffer>());
+            buffer = m_buffers.back().get();
+            buffer->tid = static_cast<std::uint32_t>(m_buffers.size());
+            buffer->name = "thread " + std::to_string(buffer->tid);
+        }
+
+        return *buffer;
+    }
+
+    void push(const Event& event)
+    {
+        if (!isEnabled())
+            return;
+
+        Buffer& buffer = local();
+        std::uint64_t head = buffer.head.load(std::memory_order_relaxed);
+
+        // The exporter must know the slot is being reused before any of its fields change
+        buffer.begun.store(head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        Slot& slot = buffer.slots[head % Capacity];
+        slot.name.store(event.name, std::memory_order_relaxed);
+        slot.start.store(event.start, std::memory_order_relaxed);
+        slot.duration.store(event.duration, std::memory_order_relaxed);
+        slot.id.store(event.id, std::memory_order_relaxed);
+        slot.phase.store(event.phase, std::memory_order_relaxed);
+
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+};
@@ -203,6 +203,134 @@ void Hud::render(sf::RenderTarget& window)
 			text_space += 20;
 		}
 	}
+
+	// RENDER PROFILER
+	if (m_show_profiler)
+		renderProfiler(window);
+
+	// RENDER METRICS
+	if (m_show_metrics)
+		renderMetrics(window);
+}
+
+/*
+*	Panel in the top right corner with the timings of every profiled section and a graph of the last frames.
+*/
+void Hud::renderProfiler(sf::RenderTarget& window)
+{
+	const float width		= 440.f;
+	const float line		= 16.f;
+	const float padding		= 10.f;
+	const float graph		= 80.f;		// graph height in px
+	const float graph_ms	= 33.3f;	// frame time at the top of the graph
+
+	auto stats	= Profiler::get().getStats();
+	auto frames	= Profiler::get().getFrameTimes();
+
+	sf::Vector2f origin
+	{
+		m_camera.getCenter().x + m_camera.getSize().x / 2.f - width - padding,
+		m_camera.getCenter().y - m_camera.getSize().y / 2.f + padding
+	};
+
+	float height = padding * 3 + line * (stats.size() + 1) + graph;
+
+	sf::RectangleShape background({ width, height });
+	background.setPosition(origin);
+	background.setFillColor({ 0, 0, 0, 170 });
+	window.draw(background);
+
+	if (!m_profiler_text)
+	{
+		m_profiler_text = std::make_unique<sf::Text>(m_font);
+		m_profiler_text->setCharacterSize(13);
+		m_profiler_text->setFillColor(sf::Color::White);
+	}
+
+	char buffer[128];
+	float y = origin.y + padding;
+
+	std::snprintf(buffer, sizeof(buffer), "%-28s %7s %7s %7s", "section (ms)", "last", "avg", "p99");
+	m_profiler_text->setString(buffer);
+	m_profiler_text->setPosition({ origin.x + padding, y });
+	window.draw(*m_profiler_text);
+
+	for (const auto& s : stats)
+	{
+		y += line;
+
+		std::snprintf(buffer, sizeof(buffer), "%-28.28s %7.2f %7.2f %7.2f", s.name.c_str(), s.last, s.average, s.p99);
+		m_profiler_text->setString(buffer);
+		m_profiler_text->setPosition({ origin.x + padding, y });
+		window.draw(*m_profiler_text);
+	}
+
+	// Frame time graph, the grey line is 60 fps
+	sf::Vector2f graph_origin{ origin.x + padding, y + line + padding + graph };
+	float graph_width = width - padding * 2;
+
+	sf::VertexArray target(sf::PrimitiveType::Lines, 2);
+	target[0].position	= { graph_origin.x, graph_origin.y - graph * (16.6f / graph_ms) };
+	target[1].position	= { graph_origin.x + graph_width, target[0].position.y };
+	target[0].color		= target[1].color = sf::Color(120, 120, 120);
+	window.draw(target);
+
+	if (frames.size() < 2)
+		return;
+
+	sf::VertexArray curve(sf::PrimitiveType::LineStrip, frames.size());
+	for (std::size_t i = 0; i < frames.size(); ++i)
+	{
+		float ratio = std::min(frames[i] / graph_ms, 1.f);
+
+		curve[i].position	= { graph_origin.x + graph_width * i / (Profiler::Window - 1), graph_origin.y - graph * ratio };
+		curve[i].color		= frames[i] > 16.6f ? sf::Color(230, 80, 80) : sf::Color(80, 230, 120);
+	}
+	window.draw(curve);
+}
+
+/*
+*	Panel in the top left corner with the current value of every metric.
+*/
+void Hud::renderMetrics(sf::RenderTarget& window)
+{
+	const float width	= 440.f;
+	const float line	= 16.f;
+	const float padding	= 10.f;
+
+	auto lines = Metrics::get().getLines();
+
+	sf::Vector2f origin
+	{
+		m_camera.getCenter().x - m_camera.getSize().x / 2.f + padding,
+		m_camera.getCenter().y - m_camera.getSize().y / 2.f + padding
+	};
+
+	sf::RectangleShape background({ width, padding * 2 + line * lines.size() });
+	background.setPosition(origin);
+	background.setFillColor({ 0, 0, 0, 170 });
+	window.draw(background);
+
+	// Shares the text object of the profiler, both use the same font and size
+	if (!m_profiler_text)
+	{
+		m_profiler_text = std::make_unique<sf::Text>(m_font);
+		m_profiler_text->setCharacterSize(13);
+		m_profiler_text->setFillColor(sf::Color::White);
+	}
+
+	char buffer[128];
+	float y = origin.y + padding;
+
+	for (const auto& l : lines)
+	{
+		std::snprintf(buffer, sizeof(buffer), "%-30.30s %s", l.name.c_str(), l.value.c_str());
+		m_profiler_text->setString(buffer);
+		m_profiler_text->setPosition({ origin.x + padding, y });
+		window.draw(*m_profiler_text);
+
+		y += line;
+	}
 }
 
 bool Hud::checkClick(const std::unique_ptr<CButton>& obj, const sf::Vector2f& mouse_pos)
@@ -33,6 +33,17 @@ class Hud
 	std::vector<std::unique_ptr<CSlider>>		sliders;
 	std::unique_ptr<CInfoBox>					info_box;
 
+	// PROFILER PANEL
+	bool										m_show_profiler{ false };
+	std::unique_ptr<sf::Text>					m_profiler_text;
+
+	void renderProfiler(sf::RenderTarget& window);
+
+	// METRICS PANEL
+	bool										m_show_metrics{ false };
+
+	void renderMetrics(sf::RenderTarget& window);
+
 public:
 
 	// CONSTRUCTOR & INITIATOR
@@ -58,6 +69,8 @@ public:
 
 	// HUD ACCESSORIES
 	void infoBox(std::vector<std::string> info);
+	void toggleProfiler() { m_show_profiler = !m_show_profiler; }
+	void toggleMetrics() { m_show_metrics = !m_show_metrics; }
 
 	// INPUTS
 	void input(const sf::Event::TextEntered& event);
@@ -5,7 +5,12 @@
 
 int main()
 {
-	Game g("config/config.json");
+	{
+		Game g("config/config.json");
 
-	g.run();
+		g.run();
+	}
+
+	// The game is gone, nothing logs anymore. Write what the async logger still holds
+	Logger::shutdown();
 }
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Coordinates.h"
+
+// CHUNK GRID CLASS	///////////////////////////
+// Items addressed by chunk coordinates (in chunks, not px). The plane is split in pages of PageSide x PageSide cells,
+// allocated the first time a chunk lands on them and freed when their last item leaves, so a lookup is a page lookup
+// (the last page is cached) and an array index. Items are also kept in a flat list for the passes that need every one
+// of them.
+template<typename T>
+class ChunkGrid
+{
+	static constexpr int PageSide = 16;
+
+	struct Cell {
+		T*				item{ nullptr };
+		std::uint32_t	slot{ 0 };			// index in m_items
+	};
+
+	struct Page {
+		std::array<Cell, PageSide * PageSide>	cells;
+		int										used{ 0 };	// cells holding an item
+	};
+
+	std::unordered_map<ChunkKey, std::unique_ptr<Page>, ChunkKeyHash>	m_pages;
+	std::vector<std::pair<sf::Vector2i, T*>>					m_items;
+
+	// Neighbouring lookups hit the same page
+	mutable ChunkKey		m_last_key{ 0 };
+	mutable Page*			m_last_page{ nullptr };
+
+	Cell* findCell(const sf::Vector2i& coord, bool create) const
+	{
+		sf::Vector2i page = floorDiv(coord, PageSide);
+		ChunkKey key = toChunkKey(page);
+
+		if (!m_last_page || m_last_key != key)
+		{
+			auto it = m_pages.find(key);
+			if (it == m_pages.end())
+			{
+				if (!create)
+					return nullptr;
+
+				it = const_cast<ChunkGrid*>(this)->m_pages.emplace(key, std::make_unique<Page>()).first;
+			}
+
+			m_last_key	= key;
+			m_last_page	= it->second.get();
+		}
+
+		return &m_last_page->cells[floorMod(coord.y, PageSide) * PageSide + floorMod(coord.x, PageSide)];
+	}
+
+	// Free the page of the coordinate, findCell has just left it cached
+	void releasePage(const sf::Vector2i& coord)
+	{
+		m_pages.erase(toChunkKey(floorDiv(coord, PageSide)));
+		m_last_page = nullptr;
+	}
+
+public:
+
+	// GETTERS
+	T* find(const sf::Vector2i& coord) const
+	{
+		Cell* cell = findCell(coord, false);
+		return cell ? cell->item : nullptr;
+	}
+
+	const std::vector<std::pair<sf::Vector2i, T*>>&	items()	const	{ return m_items; }
+	std::size_t										size()	const	{ return m_items.size(); }
+	bool											empty()	const	{ return m_items.empty(); }
+
+	// SETTERS
+	// Place the item at the coordinate, returns the one it replaced
+	T* insert(const sf::Vector2i& coord, T* item)
+	{
+		Cell* cell = findCell(coord, true);
+		T* previous = cell->item;
+
+		if (previous)
+		{
+			m_items[cell->slot].second = item;
+		}
+		else
+		{
+			cell->slot = static_cast<std::uint32_t>(m_items.size());
+			m_items.emplace_back(coord, item);
+			++m_last_page->used;
+		}
+
+		cell->item = item;
+		return previous;
+	}
+
+	// Remove the item at the coordinate, returns it
+	T* erase(const sf::Vector2i& coord)
+	{
+		Cell* cell = findCell(coord, false);
+		if (!cell || !cell->item)
+			return nullptr;
+
+		T* item = cell->item;
+		std::uint32_t slot = cell->slot;
+		cell->item = nullptr;
+
+		if (--m_last_page->used == 0)
+			releasePage(coord);
+
+		// Swap with the last one to keep the list packed
+		if (slot + 1 != m_items.size())
+		{
+			m_items[slot] = m_items.back();
+			findCell(m_items[slot].first, false)->slot = slot;
+		}
+
+		m_items.pop_back();
+		return item;
+	}
+
+	// Empty every cell and free the pages
+	void clear()
+	{
+		m_pages.clear();
+		m_last_page = nullptr;
+		m_items.clear();
+	}
+};
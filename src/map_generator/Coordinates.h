@@ -0,0 +1,56 @@
+#pragma once
+
+// COORDINATES			///////////////////////////
+// The map works in three spaces:
+//   world	px, where the camera, the entities and the vertices live. Only drawing and the entity boundary use it.
+//   tile	one unit per tile, what the chunks store and the searches walk.
+//   chunk	one unit per chunk, the key of everything chunk related.
+// Conversions round towards negative infinity, so the tiles and chunks left of and above the origin aren't shifted.
+
+// Integer division rounding towards negative infinity
+inline int floorDiv(int value, int divisor)
+{
+	int q = value / divisor;
+	return (value % divisor != 0 && (value < 0) != (divisor < 0)) ? q - 1 : q;
+}
+
+inline sf::Vector2i floorDiv(const sf::Vector2i& value, int divisor)
+{
+	return { floorDiv(value.x, divisor), floorDiv(value.y, divisor) };
+}
+
+// Remainder matching floorDiv, in [0, divisor) for a positive divisor
+inline int floorMod(int value, int divisor)
+{
+	return value - floorDiv(value, divisor) * divisor;
+}
+
+// CHUNK KEYS			///////////////////////////
+// A chunk coordinate packed in 64 bits, x in the high half
+using ChunkKey = std::uint64_t;
+
+inline ChunkKey toChunkKey(const sf::Vector2i& chunk)
+{
+	return static_cast<ChunkKey>(static_cast<std::uint32_t>(chunk.x)) << 32 | static_cast<std::uint32_t>(chunk.y);
+}
+
+inline sf::Vector2i fromChunkKey(ChunkKey key)
+{
+	return { static_cast<int>(static_cast<std::uint32_t>(key >> 32)), static_cast<int>(static_cast<std::uint32_t>(key)) };
+}
+
+// Keys of neighbouring chunks only differ in a few bits, mix them before they pick a bucket
+struct ChunkKeyHash {
+	std::size_t operator()(ChunkKey key) const noexcept {
+		return static_cast<std::size_t>(Random::mix(key));
+	}
+};
+
+// VECTOR HASH			///////////////////////////
+struct Vector2iHash {
+	std::size_t operator()(const sf::Vector2i& v) const noexcept {
+		std::size_t h1 = std::hash<int>()(v.x);
+		std::size_t h2 = std::hash<int>()(v.y);
+		return h1 ^ (h2 << 1);
+	}
+};
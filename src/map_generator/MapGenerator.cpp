@@ -3,104 +3,137 @@
 #include "MapGenerator.h"
 
 /*
-*	Decide which color for the biome.
+*	Decide which biome is at the coord. Only reads the provided settings so it is safe to call from any thread.
 */
-sf::Color MapGenerator::getBiomeColor(const sf::Vector2i& coord) {
+Elements MapGenerator::getBiomeElement(const NoiseSettings& settings, const sf::Vector2i& coord) const {
 
 	sf::Vector2f coord_f = static_cast<sf::Vector2f>(coord);
 
 	// Generate noise and wrap for natural environment
-	float warpX = coord_f.x + m_noise_wrap.GetNoise(coord_f.x, coord_f.y) * 100.0f;
-	float warpY = coord_f.y + m_noise_wrap.GetNoise(coord_f.x, coord_f.y) * 100.0f;
-	float continent = (m_noise_continent.GetNoise(warpX * m_cont_multiplier, warpY * m_cont_multiplier) + 1.0f) * 0.5f;
+	float warpX = coord_f.x + settings.noise_wrap.GetNoise(coord_f.x, coord_f.y) * 100.0f;
+	float warpY = coord_f.y + settings.noise_wrap.GetNoise(coord_f.x, coord_f.y) * 100.0f;
+	float continent = (settings.noise_continent.GetNoise(warpX * settings.cont_multiplier, warpY * settings.cont_multiplier) + 1.0f) * 0.5f;
 
 	// Generate mineral noise
-	float mineral = (m_noise_mineral.GetNoise(warpX * m_mineral_multiplier, warpY * m_mineral_multiplier) + 1.0f) * 0.5f;
+	float mineral = (settings.noise_mineral.GetNoise(warpX * settings.mineral_multiplier, warpY * settings.mineral_multiplier) + 1.0f) * 0.5f;
 
 	// --- OCEAN ---
 
-	if (continent < m_thresholds[Elements::very_deep_ocean]) return m_biomes[Elements::very_deep_ocean];
-	if (continent < m_thresholds[Elements::deep_ocean]) return m_biomes[Elements::deep_ocean];
-	if (continent < m_thresholds[Elements::ocean]) return m_biomes[Elements::ocean];
-	if (continent < m_thresholds[Elements::sand]) return m_biomes[Elements::sand];
+	if (continent < settings.threshold(Elements::very_deep_ocean)) return Elements::very_deep_ocean;
+	if (continent < settings.threshold(Elements::deep_ocean)) return Elements::deep_ocean;
+	if (continent < settings.threshold(Elements::ocean)) return Elements::ocean;
+	if (continent < settings.threshold(Elements::sand)) return Elements::sand;
 
 	// --- CONTINENT ---
-	if (continent < m_thresholds[Elements::hill])
+	if (continent < settings.threshold(Elements::hill))
 	{
-		if (mineral > m_thresholds[Elements::clay])
-			return m_biomes[Elements::clay];
+		if (mineral > settings.threshold(Elements::clay))
+			return Elements::clay;
 
-		return m_biomes[Elements::hill];
+		return Elements::hill;
 	}
 
-	if (continent < m_thresholds[Elements::forest])
+	if (continent < settings.threshold(Elements::forest))
 	{
-		if (mineral > m_thresholds[Elements::iron])
-			return m_biomes[Elements::iron];
+		if (mineral > settings.threshold(Elements::iron))
+			return Elements::iron;
 
-		return m_biomes[Elements::forest];
+		return Elements::forest;
 	}
 
 
-	if (continent < m_thresholds[Elements::muntain])
+	if (continent < settings.threshold(Elements::muntain))
 	{
-		if (mineral > m_thresholds[Elements::silver])
-			return m_biomes[Elements::silver];
+		if (mineral > settings.threshold(Elements::silver))
+			return Elements::silver;
 
-		return m_biomes[Elements::muntain];
+		return Elements::muntain;
 	}
 
 
-	return m_biomes[Elements::snow];
+	return Elements::snow;
 }
 
 /*
-*	Generate a chunk of terrain based on height and width in tiles. Position is the top left of the chunk in world.
+*	Decide which color for the biome.
 */
-std::shared_ptr<MapGenerator::Chunk> MapGenerator::generateChunk(const int height, const int width, const sf::Vector2i& position)
+sf::Color MapGenerator::getBiomeColor(const NoiseSettings& settings, const sf::Vector2i& coord) const {
+	return settings.biome(getBiomeElement(settings, coord));
+}
+
+/*
+*	Classify the tiles of a pooled chunk and index them. The storage of its previous use is overwritten, not reallocated.
+*	No geometry is built here. The noise is sampled at the px of each tile, the scale the generation parameters are tuned for.
+*/
+void MapGenerator::classifyChunk(const NoiseSettings& settings, Chunk& chunk) const
 {
-	auto chunk		= std::make_shared<Chunk>();
-	chunk->position = position;
-	chunk->vertices.setPrimitiveType(sf::PrimitiveType::Triangles);
+	int tiles_per_side{ c_chunk_tiles };
+
+	chunk.tiles_per_side = tiles_per_side;
+	sf::Vector2i first = chunk.firstTile();
+	chunk.tiles.resize(tiles_per_side * tiles_per_side);
+	chunk.land_tiles.clear();
 
-	// Step 1: store colors of all tiles
-	std::vector<std::vector<sf::Color>> colors(height * width, std::vector<sf::Color>(height * width));
+	for (auto& list : chunk.resources)
+		list.clear();
 
-	for (int ty = 0; ty < height * width; ty += m_tile_size_px)
+	for (int ty = 0; ty < tiles_per_side; ++ty)
 	{
-		for (int tx = 0; tx < height * width; tx += m_tile_size_px)
+		for (int tx = 0; tx < tiles_per_side; ++tx)
 		{
-			sf::Vector2i world{ position.x + tx , position.y + ty };
+			sf::Vector2i world = tileToWorld(first + sf::Vector2i{ tx, ty });
+			std::uint16_t index = static_cast<std::uint16_t>(ty * tiles_per_side + tx);
 
-			colors[ty / m_tile_size_px][tx / m_tile_size_px] = getBiomeColor(world);
+			Elements el = getBiomeElement(settings, world);
 
-			// TO BE IMPROVED, TEST
-			for (auto& [el, val] : m_biomes)
-			{
-				if (val == colors[ty / m_tile_size_px][tx / m_tile_size_px])
-					chunk->tile_types[sf::Vector2i{ ty / m_tile_size_px, tx / m_tile_size_px }] = el;
-			}
+			chunk.tiles[index] = el;
+			chunk.resources[static_cast<std::size_t>(el)].push_back(index);
+
+			if (isWalkable(el))
+				chunk.land_tiles.push_back(index);
 		}
 	}
 
-	int tiles_per_side{ height * width / m_tile_size_px };
+	chunk.memory = getChunkMemory(chunk);
+}
 
-	// Step 2: scan rectangles of same color
-	std::vector<std::vector<bool>> visited(tiles_per_side, std::vector<bool>(tiles_per_side, false));
+/*
+*	Build the triangles of a chunk from its tiles into vertices, merging rectangles of the same color. The only place
+*	tiles become px.
+*/
+void MapGenerator::buildMesh(const NoiseSettings& settings, const std::vector<Elements>& tiles, int tiles_per_side, const sf::Vector2i& coord, sf::VertexArray& vertices) const
+{
+	vertices.clear();
+
+	sf::Vector2i position = tileToWorld(coord * tiles_per_side);
+
+	// Scratch space of the worker, kept between chunks
+	thread_local std::vector<sf::Color> colors;
+	thread_local std::vector<bool> visited;
+
+	// Step 1: colors of the tiles
+	colors.resize(tiles.size());
+	visited.assign(tiles.size(), false);
 
+	for (std::size_t i = 0; i < tiles.size(); ++i)
+		colors[i] = settings.biome(tiles[i]);
+
+	auto at = [tiles_per_side](int x, int y) -> std::size_t { return static_cast<std::size_t>(y * tiles_per_side + x); };
+
+	// Step 2: scan rectangles of same color
 	for (int y = 0; y < tiles_per_side; ++y)
 	{
 		for (int x = 0; x < tiles_per_side; ++x)
 		{
-			if (visited[y][x]) continue;
+			if (visited[at(x, y)]) continue;
 
-			sf::Color base = colors[y][x];
+			sf::Color base = colors[at(x, y)];
 
 			// Step 1: find maximum possible width
 			int maxW = 0;
 			while (x + maxW < tiles_per_side &&
-				colors[y][x + maxW] == base &&
-				!visited[y][x + maxW]) {
+				colors[at(x + maxW, y)] == base &&
+				!visited[at(x + maxW, y)]) {
 				maxW++;
 			}
 
@@ -112,7 +145,7 @@ std::shared_ptr<MapGenerator::Chunk> MapGenerator::generateChunk(const int heigh
 			while (expand && y + h < tiles_per_side) {
 				// check row y+h for consistency up to current maxW
 				for (int w = 0; w < maxW; ++w) {
-					if (colors[y + h][x + w] != base || visited[y + h][x + w]) {
+					if (colors[at(x + w, y + h)] != base || visited[at(x + w, y + h)]) {
 						maxW = w; // shrink width if mismatch found
 						break;
 					}
@@ -134,151 +167,488 @@ std::shared_ptr<MapGenerator::Chunk> MapGenerator::generateChunk(const int heigh
 			float wpx = bestW * m_tile_size_px;
 			float hpx = bestH * m_tile_size_px;
 
-			chunk->vertices.append({ {worldX,       worldY},       base });
-			chunk->vertices.append({ {worldX + wpx, worldY},       base });
-			chunk->vertices.append({ {worldX + wpx, worldY + hpx}, base });
+			vertices.append({ {worldX,       worldY},       base });
+			vertices.append({ {worldX + wpx, worldY},       base });
+			vertices.append({ {worldX + wpx, worldY + hpx}, base });
 
-			chunk->vertices.append({ {worldX,       worldY},       base });
-			chunk->vertices.append({ {worldX + wpx, worldY + hpx}, base });
-			chunk->vertices.append({ {worldX,       worldY + hpx}, base });
+			vertices.append({ {worldX,       worldY},       base });
+			vertices.append({ {worldX + wpx, worldY + hpx}, base });
+			vertices.append({ {worldX,       worldY + hpx}, base });
 
 			// Step 4: mark visited
 			for (int yy = 0; yy < bestH; ++yy)
 				for (int xx = 0; xx < bestW; ++xx)
-					visited[y + yy][x + xx] = true;
+					visited[at(x + xx, y + yy)] = true;
 		}
 	}
+}
+
+/*
+*	Rough footprint of a chunk used by the residency budget. The mesh buffers keep their storage between jobs, the back
+*	vertex buffer is cleared on arrival but holds as much as the front one, VertexArray does not expose its capacity.
+*/
+std::size_t MapGenerator::getChunkMemory(const Chunk& chunk)
+{
+	std::size_t vertices = std::max(chunk.vertices.getVertexCount(), chunk.mesh_vertices.getVertexCount());
+
+	return sizeof(Chunk)
+		+ (chunk.vertices.getVertexCount() + vertices) * sizeof(sf::Vertex)
+		+ chunk.tiles.size() * sizeof(Elements)
+		+ chunk.mesh_tiles.capacity() * sizeof(Elements)
+		+ chunk.land_tiles.size() * sizeof(std::uint16_t)
+		+ chunk.tiles.size() * sizeof(std::uint16_t);	// resources index
+}
+
+/*
+*	Take a chunk from the pool, or make one while the pool is still growing. Its storage keeps the capacity of its last use.
+*/
+MapGenerator::Chunk* MapGenerator::acquireChunk(const sf::Vector2i& coord)
+{
+	Chunk* chunk;
+
+	if (c_pool_free.empty())
+	{
+		c_pool.push_back(std::make_unique<Chunk>());
+		chunk = c_pool.back().get();
+		chunk->vertices.setPrimitiveType(sf::PrimitiveType::Triangles);
+		chunk->mesh_vertices.setPrimitiveType(sf::PrimitiveType::Triangles);
+	}
+	else
+	{
+		chunk = c_pool_free.back();
+		c_pool_free.pop_back();
+	}
+
+	chunk->coord			= coord;
+	chunk->vertices.clear();
+	chunk->mesh_revision	= 0;
+	chunk->mesh_pending		= false;
+	chunk->retired			= false;
+	chunk->unload			= true;
+	chunk->last_seen		= 0;
+	chunk->last_referenced	= -1;
+	chunk->memory			= 0;
+	chunk->epoch			= 0;
+	chunk->revision			= 0;
 
 	return chunk;
 }
 
 /*
-*	Generate chunks if needed. (made to run on separate thread)
+*	Give a chunk back to the pool. A chunk a mesh job is still writing goes back when the mesh arrives.
+*/
+void MapGenerator::releaseChunk(Chunk* chunk)
+{
+	if (chunk->mesh_pending)
+	{
+		chunk->retired = true;
+		return;
+	}
+
+	c_pool_free.push_back(chunk);
+}
+
+/*
+*	Classify a single chunk and hand it to the render thread. (Runs on the generator pool)
 */
-void MapGenerator::startChunksGenerator()
+void MapGenerator::generateChunkTask(Chunk* chunk)
 { 
-	while (s_running) 
-	{ 
-		std::optional<sf::Vector2i> optChunkPos = tc_chunks_in_queue.pop();
-
-		if (!optChunkPos.has_value()) 
-		{ 
-			std::this_thread::sleep_for(std::chrono::milliseconds(5)); 
-			continue; 
-		} 
-	
-		auto chunk = generateChunk(c_chunk_size, c_chunk_size, *optChunkPos);
+	if (!s_running)
+		return;
+
+	PROFILE_SCOPE("Map/ChunkGeneration (workers)");
+
+	// Capture the current parameters, chunks from a stale epoch are dropped on arrival
+	auto settings = getSettings();
+
+	classifyChunk(*settings, *chunk);
+	chunk->epoch = settings->epoch;
 
-		std::lock_guard<std::mutex> lock(t_mutex);
-		tc_chunks_ready.push(chunk);
-	} 
+	tc_chunks_ready.push(chunk);
 }
 
 /*
-*	Helper function to render. Find next chunk position relative to pos.
+*	Build the mesh of a chunk from the snapshot of its tiles, into its back buffer. (Runs on the generator pool)
 */
-sf::Vector2i getNextChunkPosition(const sf::Vector2i& pos, int multiple) {
-	auto next = [multiple](int p)->int {
-		int r = p % multiple;
-		if (r == 0) return p;
-		return (p > 0) ? (p + (multiple - r)) : (p - r);
-		};
-	return { next(pos.x), next(pos.y) };
+void MapGenerator::buildMeshTask(Chunk* chunk)
+{
+	if (!s_running)
+		return;
+
+	PROFILE_SCOPE("Map/MeshBuild (workers)");
+
+	auto settings = getSettings();
+
+	buildMesh(*settings, chunk->mesh_tiles, chunk->tiles_per_side, chunk->coord, chunk->mesh_vertices);
+
+	tc_meshes_ready.push(chunk);
 }
 
 /*
-*	Helper function to render. Check if there is intersection between view and chunk.
+*	Submit a mesh job for the chunks without an up to date mesh, nearest to the view first.
+*	The job reads a snapshot of the tiles, the main thread keeps editing the originals.
 */
-bool chunkInView(const sf::Vector2i& chunkPos, const sf::Vector2i& chunkSize, const sf::IntRect& viewBounds)
+void MapGenerator::submitMeshes(std::vector<Chunk*>& chunks, const sf::Vector2i& center_tile)
 {
-	const int preload = chunkSize.x; // preload 1 chunk around
+	if (!c_build_meshes || t_meshes_pending >= t_max_pending)
+		return;
 
-	sf::IntRect expandedView = viewBounds;
-	expandedView.position.x -= preload * 4;
-	expandedView.position.y -= preload * 4;
-	expandedView.size.x += preload * 8;
-	expandedView.size.y += preload * 8;
+	auto distance = [&center_tile](const Chunk& chunk) -> long long
+	{
+		long long dx = chunk.firstTile().x + chunk.tiles_per_side / 2 - center_tile.x;
+		long long dy = chunk.firstTile().y + chunk.tiles_per_side / 2 - center_tile.y;
+		return dx * dx + dy * dy;
+	};
 
-	sf::IntRect chunkBounds(
-		sf::Vector2i{ chunkPos.x , chunkPos.y },
-		sf::Vector2i{ chunkSize.x , chunkSize.y }
-	);
+	std::sort(chunks.begin(), chunks.end(), [&distance](const Chunk* a, const Chunk* b)
+	{
+		return distance(*a) < distance(*b);
+	});
+
+	for (Chunk* chunk : chunks)
+	{
+		if (t_meshes_pending >= t_max_pending)
+			break;
+
+		if (chunk->mesh_pending || chunk->mesh_revision == chunk->revision)
+			continue;
+
+		chunk->mesh_pending		= true;
+		chunk->mesh_tiles		= chunk->tiles;
+		chunk->mesh_built_from	= chunk->revision;
+		++t_meshes_pending;
+
+		t_threads.detach_task([this, chunk] { buildMeshTask(chunk); });
+	}
+}
+
+/*
+*	Area to keep loaded around the view, in px like the camera. It is extended along the camera motion by the
+*	look-ahead budget and grown while zooming out, while the margin shrinks behind the camera.
+*/
+sf::IntRect MapGenerator::getPrefetchArea(const sf::IntRect& viewBounds) const
+{
+	const sf::Vector2i& position	= viewBounds.position;
+	const sf::Vector2i& view_size	= viewBounds.size;
+
+	int margin				{ getChunkPx() * c_chunk_margin };
+	int margin_behind		{ getChunkPx() * std::max(0, c_chunk_margin - 1) };
+
+	sf::Vector2f velocity	= s_camera_velocity.load();
+	float zoom_trend		= s_zoom_trend.load();
+
+	// Distance the view will travel within the look-ahead budget
+	sf::Vector2i lead
+	{
+		static_cast<int>(velocity.x * c_prefetch_lookahead),
+		static_cast<int>(velocity.y * c_prefetch_lookahead)
+	};
+
+	// Extra size of the view if it keeps zooming out, at most one more view
+	sf::Vector2i grow{ 0, 0 };
+	if (zoom_trend > 0.f)
+	{
+		float factor = std::min(zoom_trend * c_prefetch_lookahead, 1.f);
+
+		grow.x = static_cast<int>(view_size.x * factor) / 2;
+		grow.y = static_cast<int>(view_size.y * factor) / 2;
+	}
+
+	// Margin on one side of an axis, forward is the positive direction
+	auto extent = [&](int axis_lead, bool forward) -> int
+	{
+		if (std::abs(axis_lead) < m_tile_size_px)
+			return margin;
+
+		return (axis_lead > 0) == forward ? margin + std::abs(axis_lead) : margin_behind;
+	};
+
+	int left	= extent(lead.x, false) + grow.x;
+	int right	= extent(lead.x, true) + grow.x;
+	int top		= extent(lead.y, false) + grow.y;
+	int bottom	= extent(lead.y, true) + grow.y;
+
+	return {
+		sf::Vector2i{ position.x - left, position.y - top },
+		sf::Vector2i{ view_size.x + left + right, view_size.y + top + bottom }
+	};
+}
+
+/*
+*	Chunks overlapping an area in px, as a rectangle of chunk coordinates.
+*/
+sf::IntRect MapGenerator::getChunkRange(const sf::IntRect& area) const
+{
+	sf::Vector2i first	= worldToChunk(area.position);
+	sf::Vector2i last	= worldToChunk(area.position + area.size - sf::Vector2i{ 1, 1 });
+
+	return sf::IntRect{ first, last - first + sf::Vector2i{ 1, 1 } };
+}
+
+/*
+*	Chunks to draw for the view, in chunk coordinates. The view is extended to preload the chunks around it.
+*/
+sf::IntRect MapGenerator::getVisibleRange(const sf::IntRect& viewBounds) const
+{
+	const int preload = getChunkPx() * 4; // preload 4 chunks around
+
+	return getChunkRange(sf::IntRect
+	{
+		viewBounds.position - sf::Vector2i{ preload, preload },
+		viewBounds.size + sf::Vector2i{ preload * 2, preload * 2 }
+	});
+}
+
+/*
+*	Move the draw area to a new range. Leaving chunks are stamped with the frame, entering ones are looked up in the grid.
+*/
+void MapGenerator::updateVisible(const sf::IntRect& range)
+{
+	if (range == c_visible_range)
+		return;
+
+	PROFILE_SCOPE("Map/UpdateVisible");
+
+	for (Chunk* chunk : c_visible)
+	{
+		if (!range.contains(chunk->coord))
+			chunk->last_seen = i_frames;
+	}
+
+	c_visible.erase(std::remove_if(c_visible.begin(), c_visible.end(), [&range](const Chunk* chunk)
+	{
+		return !range.contains(chunk->coord);
+	}), c_visible.end());
+
+	for (int y = range.position.y; y < range.position.y + range.size.y; ++y)
+	{
+		for (int x = range.position.x; x < range.position.x + range.size.x; ++x)
+		{
+			if (c_visible_range.contains({ x, y }))
+				continue;
+
+			if (Chunk* chunk = c_chunks.find({ x, y }))
+				c_visible.push_back(chunk);
+		}
+	}
+
+	c_visible_range = range;
+}
+
+/*
+*	Unload the least recently seen chunks until the budget is met. Chunks in the draw area, in the keep range or
+*	pinned stay. (Chunk coordinates)
+*/
+void MapGenerator::evictChunks(const sf::IntRect& keep_range)
+{
+	PROFILE_SCOPE("Map/Evict");
+
+	static auto& chunks_evicted = Metrics::get().counter("map.chunks_evicted");
+
+	c_evictable.clear();
+
+	for (const auto& [coord, chunk] : c_chunks.items())
+	{
+		if (!c_visible_range.contains(coord) && !keep_range.contains(coord) && !isChunkPinned(*chunk))
+			c_evictable.push_back(chunk);
+	}
+
+	std::sort(c_evictable.begin(), c_evictable.end(), [](const Chunk* a, const Chunk* b)
+	{
+		return a->last_seen < b->last_seen;
+	});
+
+	for (Chunk* chunk : c_evictable)
+	{
+		if (c_resident_bytes <= c_memory_budget)
+			break;
+
+		unloadChunk(chunk);
+		chunks_evicted.add();
+	}
+}
+
+/*
+*	After a parameter change, old chunks nothing will replace leave at once. The ones in the keep range (chunk
+*	coordinates) are being generated again, and the drawn ones stay until they leave the draw area.
+*/
+void MapGenerator::dropStaleChunks(const sf::IntRect& keep_range)
+{
+	PROFILE_SCOPE("Map/DropStale");
 
-	return chunkBounds.findIntersection(expandedView) != std::nullopt;
+	c_evictable.clear();
+	c_stale_resident = false;
+
+	for (const auto& [coord, chunk] : c_chunks.items())
+	{
+		if (chunk->epoch == m_epoch)
+			continue;
+
+		if (c_visible_range.contains(coord) || keep_range.contains(coord))
+			c_stale_resident = true;
+		else
+			c_evictable.push_back(chunk);
+	}
+
+	for (Chunk* chunk : c_evictable)
+		unloadChunk(chunk);
+}
+
+/*
+*	Take a resident chunk off the map and give it back to the pool. Logged as a change, its tiles are gone.
+*/
+void MapGenerator::unloadChunk(Chunk* chunk)
+{
+	logChunkChange(chunk->coord);
+
+	c_resident_bytes -= chunk->memory;
+	c_chunks.erase(chunk->coord);
+	releaseChunk(chunk);
 }
 
 /*
 *	Render chunks based on view boundaries.
 */
 void MapGenerator::render(const sf::IntRect& viewBounds, sf::RenderTarget& window) {
-	int num_tiles_per_chunk = c_chunk_size * c_chunk_size;
-	sf::Vector2i chunk_alligned_position = getNextChunkPosition(viewBounds.position, num_tiles_per_chunk);
+	PROFILE_SCOPE("Map/Render");
 
-	// UPDATE in case of changes, only every 20 frames
+	// UPDATE in case of changes, only every 20 frames. Old chunks stay on screen until their replacement arrives
 	if (m_reset && i_frames % 20 == 0)
 	{
 		m_reset = false;
 
 		setNoises();
 		print();
-
-		std::lock_guard<std::mutex> lock(t_mutex);
-		c_chunks.clear();
 	}
 	
-	// Send camera data to worker
-	s_camera_position.store(chunk_alligned_position);
-	s_view_size.store(viewBounds.size);
+	static auto& chunks_generated	= Metrics::get().counter("map.chunks_generated");
+	static auto& chunks_stale		= Metrics::get().counter("map.chunks_stale");
+	static auto& chunks_resident	= Metrics::get().gauge("map.chunks_resident");
+	static auto& chunks_pending		= Metrics::get().gauge("map.chunks_pending");
+	static auto& chunks_ready		= Metrics::get().gauge("map.chunks_ready");
+	static auto& resident_bytes		= Metrics::get().gauge("map.resident_bytes");
+	static auto& meshes_built		= Metrics::get().counter("map.meshes_built");
+	static auto& meshes_pending		= Metrics::get().gauge("map.meshes_pending");
+	static auto& chunks_pooled		= Metrics::get().gauge("map.chunks_pooled");
+
+	chunks_ready.set(static_cast<std::int64_t>(tc_chunks_ready.size()));
+
+	// Pull ready chunks from workers, in position order so the revision stamps don't depend on which worker finished first
+	c_arrived.clear();
+	while (auto chunk = tc_chunks_ready.pop())
+		c_arrived.push_back(*chunk);
+
+	std::sort(c_arrived.begin(), c_arrived.end(), [](const Chunk* a, const Chunk* b)
+	{
+		return a->coord.y != b->coord.y ? a->coord.y < b->coord.y : a->coord.x < b->coord.x;
+	});
 
-	// Pull ready chunks from worker
-	while (true) 
+	for (Chunk* chunk : c_arrived)
 	{
-		if (tc_chunks_ready.empty()) break; // No more chunks ready
+		c_chunks_pending.erase(toChunkKey(chunk->coord));
+
+		// Built with outdated parameters
+		if (chunk->epoch != m_epoch)
+		{
+			releaseChunk(chunk);
+			chunks_stale.add();
+			continue;
+		}
+
+		chunks_generated.add();
+
+		// Edited in a loaded save
+		auto saved = c_saved_tiles.find(toChunkKey(chunk->coord));
+		if (saved != c_saved_tiles.end())
+		{
+			applySavedTiles(*chunk, saved->second);
+			c_saved_tiles.erase(saved);
+		}
+
+		stampChunk(*chunk);
 
-		auto chunk = tc_chunks_ready.pop();
+		// The replaced chunk stays on screen until the new mesh is built, the buffers are swapped, not copied
+		Chunk* replaced = c_chunks.insert(chunk->coord, chunk);
+		if (replaced)
+		{
+			std::swap(chunk->vertices, replaced->vertices);
+			chunk->memory = getChunkMemory(*chunk);
+			c_resident_bytes -= replaced->memory;
+			releaseChunk(replaced);
+		}
 
-		std::lock_guard<std::mutex> lock(t_mutex);
-		c_chunks[(*chunk)->position] = *chunk;
+		chunk->last_seen = i_frames;
+		c_resident_bytes += chunk->memory;
+
+		// Landed in the draw area
+		if (c_visible_range.contains(chunk->coord))
+		{
+			auto it = std::find(c_visible.begin(), c_visible.end(), replaced);
+			if (replaced && it != c_visible.end())
+				*it = chunk;
+			else
+				c_visible.push_back(chunk);
+		}
 	}
 
-	// Calculate visible chunks
-	std::vector<std::shared_ptr<Chunk>> visibleChunks;
+	// Pull built meshes. A mesh of an older revision is still shown, a new job follows for the current one
+	while (auto mesh = tc_meshes_ready.pop())
 	{
-		std::lock_guard<std::mutex> lock(t_mutex);
+		Chunk* chunk = *mesh;
+
+		--t_meshes_pending;
+		chunk->mesh_pending = false;
 
-		for (auto it = c_chunks.begin(); it != c_chunks.end(); ) 
+		// Evicted or replaced while the job was running
+		if (chunk->retired)
 		{
-			const sf::Vector2i& pos = it->first;
+			releaseChunk(chunk);
+			continue;
+		}
 
-			if (chunkInView(pos, { num_tiles_per_chunk, num_tiles_per_chunk }, viewBounds)) 
-			{
-				visibleChunks.push_back(it->second);
-				++it;
-			}
-			else 
-			{
-				// Calculate chunk distance from view
-				sf::Vector2i chunkCenter = pos + sf::Vector2i(num_tiles_per_chunk / 2, num_tiles_per_chunk / 2);
-				sf::Vector2i viewCenter = viewBounds.position + (viewBounds.size / 2);
+		std::swap(chunk->vertices, chunk->mesh_vertices);
+		chunk->mesh_vertices.clear();
+		chunk->mesh_revision = chunk->mesh_built_from;
 
-				int dx = std::abs(chunkCenter.x - viewCenter.x) / num_tiles_per_chunk;
-				int dy = std::abs(chunkCenter.y - viewCenter.y) / num_tiles_per_chunk;
+		c_resident_bytes -= chunk->memory;
+		chunk->memory = getChunkMemory(*chunk);
+		c_resident_bytes += chunk->memory;
 
-				if (dx > (viewBounds.size.x / num_tiles_per_chunk) / 2 + c_chunk_margin ||
-					dy > (viewBounds.size.y / num_tiles_per_chunk) / 2 + c_chunk_margin) 
-				{
-					// Too far — unload it
-					it = c_chunks.erase(it);
-				}
-				else {
-					++it;
-				}
-			}
-		}
+		meshes_built.add();
+	}
+
+	// Submit missing chunks to the pool
+	fillQueueChunks(viewBounds);
+	chunks_pending.set(static_cast<std::int64_t>(c_chunks_pending.size()));
+
+	// Follow the view, only the chunks entering or leaving the draw area are touched
+	updateVisible(getVisibleRange(viewBounds));
+
+	// Old terrain must not linger where no replacement is coming, perception and paths would keep reading it
+	if (c_stale_resident)
+		dropStaleChunks(getChunkRange(getPrefetchArea(viewBounds)));
+
+	// Over budget, unload the least recently seen chunks. The only pass over every resident chunk
+	if (c_resident_bytes > c_memory_budget)
+	{
+		// Chunks must leave the active area by some margin before they can go (avoids thrashing on the border)
+		sf::IntRect keep = getChunkRange(getPrefetchArea(viewBounds));
+		keep.position	-= sf::Vector2i{ c_unload_hysteresis, c_unload_hysteresis };
+		keep.size		+= sf::Vector2i{ c_unload_hysteresis * 2, c_unload_hysteresis * 2 };
+
+		evictChunks(keep);
 	}
 
+	chunks_resident.set(static_cast<std::int64_t>(c_chunks.size()));
+	resident_bytes.set(static_cast<std::int64_t>(c_resident_bytes));
+	chunks_pooled.set(static_cast<std::int64_t>(c_pool.size()));
+
+	// Only the chunks about to be drawn get a mesh
+	submitMeshes(c_visible, worldToTile(viewBounds.position + viewBounds.size / 2));
+	meshes_pending.set(static_cast<std::int64_t>(t_meshes_pending));
+
 	// Draw all chunks in view
-	for (auto& chunk : visibleChunks) 
+	for (Chunk* chunk : c_visible) 
 	{
 		if (d_wire_frame)
 		{
@@ -301,259 +671,668 @@ void MapGenerator::render(const sf::IntRect& viewBounds, sf::RenderTarget& windo
 			//window.draw(chunk->wire);
 	}
 
-	//std::cout << c_chunks.size() << '\n';
 }
 
 /*
-*	Function to fill the queue of chunks to generate. (Made to be run on different thread)
+*	Submit the chunks missing around the view to the generator pool, nearest first.
 */
-void MapGenerator::fillQueueChunks()
+void MapGenerator::fillQueueChunks(const sf::IntRect& viewBounds)
 {
-	while (s_running)
-	{
-		sf::Vector2i alignedPos = s_camera_position.load();
-		sf::Vector2i viewSize	= s_view_size.load();
-		int num_tiles_per_chunk	{ c_chunk_size * c_chunk_size };
-		int num_tile_plus		{ num_tiles_per_chunk * c_chunk_margin };
+	if (c_chunks_pending.size() >= t_max_pending)
+		return;
 
-		// Find missing chunks and add them to the queue
-		for (int y = alignedPos.y - num_tile_plus; y < alignedPos.y + viewSize.y + num_tile_plus; y += num_tiles_per_chunk)
+	PROFILE_SCOPE("Map/FillQueue");
+
+	// Chunks around the view, stretched towards where the camera is heading
+	sf::IntRect range		= getChunkRange(getPrefetchArea(viewBounds));
+	sf::Vector2i centerTile	= worldToTile(viewBounds.position + viewBounds.size / 2);
+
+	// Find missing chunks
+	c_missing.clear();
+	for (int y = range.position.y; y < range.position.y + range.size.y; ++y)
+	{
+		for (int x = range.position.x; x < range.position.x + range.size.x; ++x)
 		{
-			for (int x = alignedPos.x - num_tile_plus; x < alignedPos.x + viewSize.x + num_tile_plus; x += num_tiles_per_chunk)
-			{
-				sf::Vector2i chunkPos(x, y); 
-				sf::Vector2i chunkPosTile{ worldToTile(chunkPos)};
+			sf::Vector2i coord(x, y);
 
-				LOG_DEBUG("Chunk Position in World: {} {}", chunkPos.x, chunkPos.y);
-				LOG_DEBUG("Chunk Position in Tile: {} {}", chunkPosTile.x, chunkPosTile.y);
+			// Chunks from an older epoch are regenerated, but kept until the new one is ready
+			Chunk* chunk = c_chunks.find(coord);
+			if ((chunk && chunk->epoch == m_epoch) || c_chunks_pending.count(toChunkKey(coord)))
+				continue;
 
-				
-				{
-					std::lock_guard<std::mutex> lock(t_mutex);
-					if (c_chunks.find(chunkPos) != c_chunks.end() || tc_chunks_ready.containsPosition(chunkPos) || tc_chunks_in_queue.contains(chunkPos))
-						continue;
-				}
-				
-				tc_chunks_in_queue.push(chunkPos);
-			}
+			c_missing.push_back(coord);
 		}
+	}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	// Nearest chunks to the view go first
+	auto distance = [this, &centerTile](const sf::Vector2i& coord) -> long long
+	{
+		long long dx = coord.x * c_chunk_tiles + c_chunk_tiles / 2 - centerTile.x;
+		long long dy = coord.y * c_chunk_tiles + c_chunk_tiles / 2 - centerTile.y;
+		return dx * dx + dy * dy;
+	};
+
+	std::sort(c_missing.begin(), c_missing.end(), [&distance](const sf::Vector2i& a, const sf::Vector2i& b)
+	{
+		return distance(a) < distance(b);
+	});
+
+	static auto& latency = Metrics::get().histogram("map.chunk_latency_ms");
+
+	// Keep the pool queue short so it follows the camera, any idle worker picks the next chunk
+	for (auto& coord : c_missing)
+	{
+		if (c_chunks_pending.size() >= t_max_pending)
+			break;
+
+		c_chunks_pending.insert(toChunkKey(coord));
+		Chunk* chunk = acquireChunk(coord);
+
+		// Time spent waiting for a worker shows as an async span on the trace
+		std::uint64_t id		= ++t_submitted;
+		std::uint64_t queued	= Trace::get().now();
+
+		t_threads.detach_task([this, chunk, id, queued]
+		{
+			Trace::get().async("Map/ChunkQueued", id, queued, Trace::get().now());
+			generateChunkTask(chunk);
+
+			// From the submission to the chunk waiting in tc_chunks_ready
+			latency.observe(static_cast<float>(Trace::get().now() - queued) / 1000.f);
+		});
 	}
 }
 
 /*
-*	Re-set seed and frequency for FastNoiseLite obj
+*	Build a new snapshot of the generation parameters and publish it to the workers.
 */
 void MapGenerator::setNoises()
 {
-	m_noise_continent.SetSeed(m_seed);
-	m_noise_continent.SetFrequency(m_cont_freq);
-	
-	m_noise_wrap.SetSeed(m_seed);
-	m_noise_wrap.SetFrequency(m_warp_freq);
+	auto settings = std::make_shared<NoiseSettings>();
+
+	++c_terrain_version;
 
-	m_noise_mineral.SetSeed(m_seed);
-	m_noise_mineral.SetFrequency(m_mineral_freq);
+	// Edits belong to the parameters they were made with and go with the old world: edits of a loaded save are
+	// dropped, edited chunks are unpinned and replaced or unloaded like the others
+	c_saved_tiles.clear();
+
+	for (const auto& [coord, chunk] : c_chunks.items())
+		chunk->unload = true;
+
+	c_stale_resident = !c_chunks.empty();
+
+	settings->epoch					= ++m_epoch;
+	settings->seed					= m_seed;
+	settings->cont_multiplier		= m_cont_multiplier;
+	settings->mineral_multiplier	= m_mineral_multiplier;
+	settings->biomes				= m_biomes;
+	settings->thresholds			= m_thresholds;
+
+	settings->noise_continent.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
+	settings->noise_continent.SetFractalType(FastNoiseLite::FractalType_FBm);
+	settings->noise_continent.SetSeed(m_seed);
+	settings->noise_continent.SetFrequency(m_cont_freq);
+
+	settings->noise_wrap.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+	settings->noise_wrap.SetFractalType(FastNoiseLite::FractalType_FBm);
+	settings->noise_wrap.SetSeed(m_seed);
+	settings->noise_wrap.SetFrequency(m_warp_freq);
+
+	settings->noise_mineral.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+	settings->noise_mineral.SetFractalType(FastNoiseLite::FractalType_FBm);
+	settings->noise_mineral.SetSeed(m_seed);
+	settings->noise_mineral.SetFrequency(m_mineral_freq);
+
+	std::atomic_store(&m_settings, std::shared_ptr<const NoiseSettings>(std::move(settings)));
 }
 
 /*
-*	Return the information at the requested map position.
+*	Return the information at the requested map position, read from the tile of the resident chunk (edits included).
 */
 std::vector<std::string> MapGenerator::getPositionInfo(sf::Vector2i pos)
 {
     std::vector<std::string> result;
 
-    int num_tiles_per_chunk = c_chunk_size * c_chunk_size;
-    sf::Vector2i chunkPos = getNextChunkPosition
-							(
-								sf::Vector2i(static_cast<int>(pos.x), static_cast<int>(pos.y)),
-								num_tiles_per_chunk
-							);
+    sf::Vector2i tile = worldToTile(pos);
+    Chunk* chunk = c_chunks.find(tileToChunk(tile));
 
-    auto it = c_chunks.find(chunkPos);
-    if (it == c_chunks.end() || !it->second)
+    if (!chunk)
     {
         result.push_back("Unknown");
         return result;
     }
 
-    // Find world tile and biome color
-    sf::Vector2i tile = worldToTile(pos);
-    sf::Vector2i tileWorld = tileToWorld(tile);
-    sf::Color tileColor = getBiomeColor(pos);
+    sf::Vector2i local = tile - chunk->firstTile();
+    Elements el = chunk->tiles[local.y * chunk->tiles_per_side + local.x];
 
-    for (const auto& [key, color] : m_biomes) 
-	{
-        if (color == tileColor)
-        {
-			result.push_back("Type: " + std::to_string(static_cast<int>(key)));
-            break;
-        }
-    }
-
-    if(result.empty())
-        result.push_back("Unknown");
-    else
-    {
-        result.push_back("X: " + std::to_string(static_cast<int>(tileWorld.x)));
-        result.push_back("Y: " + std::to_string(static_cast<int>(tileWorld.y)));
-    }
+    result.push_back("Type: " + std::to_string(static_cast<int>(el)));
+    result.push_back("X: " + std::to_string(tile.x));
+    result.push_back("Y: " + std::to_string(tile.y));
 
     return result;
 }
 
 /*
-*	Return a random coord in px in the provided radius != than water
+*	Return a random walkable coord in px within the radius, sampled from the land tiles of the loaded chunks.
+*	Only the land tiles of the rows crossed by the circle are drawn from, so nearly every attempt lands inside it.
+*	Gives up after a fixed number of attempts, so the cost is bounded.
 */
-sf::Vector2i MapGenerator::getLocationWithinBound(sf::Vector2i& pos, float radius)
+std::optional<sf::Vector2i> MapGenerator::getLocationWithinBound(const sf::Vector2i& pos, float radius, Random::Stream& rng) const
 {
-	int num_tiles_per_chunk = c_chunk_size * c_chunk_size;
-	sf::Vector2i chunkPos = getNextChunkPosition(pos, num_tiles_per_chunk);
+	// Run of a chunk's land list inside the circle's chord on one row
+	struct Window {
+		const Chunk*	chunk;
+		std::uint32_t	begin;
+		std::uint32_t	count;
+	};
+
+	// Scratch space of the caller's thread, kept between calls
+	thread_local std::vector<Window> windows;
+	windows.clear();
 
-	auto it = c_chunks.find(chunkPos);
-	if (it == c_chunks.end() || !it->second)
+	int r = static_cast<int>(radius);
+	long long radius_sq = static_cast<long long>(r) * r;
+	std::size_t total_land{ 0 };
+
+	sf::Vector2i first_tile	= worldToTile(pos - sf::Vector2i{ r, r });
+	sf::Vector2i last_tile	= worldToTile(pos + sf::Vector2i{ r, r });
+
+	for (int ty = first_tile.y; ty <= last_tile.y; ++ty)
 	{
-		return pos; // If chunk is not found return current position
+		long long dy = getTileCenter({ 0, ty }).y - pos.y;
+		if (dy * dy > radius_sq)
+			continue;
+
+		// Columns under the chord of the circle on this row
+		int half = static_cast<int>(std::sqrt(static_cast<double>(radius_sq - dy * dy)));
+		int tx0 = worldToTile(pos - sf::Vector2i{ half, 0 }).x;
+		int tx1 = worldToTile(pos + sf::Vector2i{ half, 0 }).x;
+
+		int cy = floorDiv(ty, c_chunk_tiles);
+
+		for (int cx = floorDiv(tx0, c_chunk_tiles); cx <= floorDiv(tx1, c_chunk_tiles); ++cx)
+		{
+			const Chunk* chunk = c_chunks.find({ cx, cy });
+			if (!chunk || chunk->land_tiles.empty())
+				continue;
+
+			// Land indices are sorted, the row segment is a contiguous run of them
+			int tps = chunk->tiles_per_side;
+			int row = (ty - cy * tps) * tps;
+			int col0 = std::max(tx0 - cx * tps, 0);
+			int col1 = std::min(tx1 - cx * tps, tps - 1);
+
+			auto lo = std::lower_bound(chunk->land_tiles.begin(), chunk->land_tiles.end(), static_cast<std::uint16_t>(row + col0));
+			auto hi = std::upper_bound(lo, chunk->land_tiles.end(), static_cast<std::uint16_t>(row + col1));
+
+			if (lo == hi)
+				continue;
+
+			windows.push_back(Window{ chunk, static_cast<std::uint32_t>(lo - chunk->land_tiles.begin()), static_cast<std::uint32_t>(hi - lo) });
+			total_land += static_cast<std::size_t>(hi - lo);
+		}
 	}
 
-	sf::Color tileColor;
-	sf::Vector2i random{ 0, 0 };
+	if (windows.empty())
+		return std::nullopt;
 
-	while (tileColor.r == 0)
+	for (int attempt = 0; attempt < c_sample_attempts; ++attempt)
 	{
-		random.x = Random::get<int, int, int>(pos.x - radius, pos.x + radius);
-		random.y = Random::get<int, int, int>(pos.y - radius, pos.y + radius);
+		// Pick a land tile, every tile has the same chance
+		std::size_t pick = static_cast<std::size_t>(rng.get(0, static_cast<int>(total_land) - 1));
+
+		for (const Window& window : windows)
+		{
+			if (pick >= window.count)
+			{
+				pick -= window.count;
+				continue;
+			}
+
+			const Chunk* chunk = window.chunk;
+			std::uint16_t index = chunk->land_tiles[window.begin + pick];
+			sf::Vector2i tile = getTileCenter(chunk->firstTile() + sf::Vector2i{ index % chunk->tiles_per_side, index / chunk->tiles_per_side });
+
+			// The chord is rounded to whole tiles, the ends can still fall outside
+			long long dx = tile.x - pos.x;
+			long long dy = tile.y - pos.y;
+
+			if (dx * dx + dy * dy <= radius_sq)
+				return tile;
 
-		tileColor = getBiomeColor(random);
+			break;
+		}
 	}
 
-	return random;
+	return std::nullopt;
 }
 
 
-// Return a map of resources found within the boundaries.
-std::unordered_map<Elements, sf::Vector2i> MapGenerator::getResourcesWithinBoundary(sf::Vector2i& pos, float radius)
+// Return the closest tile of every element within the radius.
+// Only the chunks overlapping the circle are searched, nearest first, through their resources index.
+// With seen_from, tiles already within the radius of that position are skipped: each row is cut down to the columns
+// the move newly revealed before its index lists are walked.
+std::unordered_map<Elements, sf::Vector2i> MapGenerator::getResourcesWithinBoundary(const sf::Vector2i& pos, float radius, const std::optional<sf::Vector2i>& seen_from) const
 {
-	std::unordered_map<Elements, std::pair<float, sf::Vector2i>> closest;
-	sf::Vector2i centerTile = worldToTile(pos);
-	int tileRadius = static_cast<int>(radius / m_tile_size_px);
+	int chunk_px = getChunkPx();
+	int r = static_cast<int>(radius);
+	long long radius_sq = static_cast<long long>(r) * r;
+
+	// Chunks overlapping the circle with their distance from pos (px, the entities live there)
+	std::vector<std::pair<long long, const Chunk*>> candidates;
+
+	sf::Vector2i first	= worldToChunk(pos - sf::Vector2i{ r, r });
+	sf::Vector2i last	= worldToChunk(pos + sf::Vector2i{ r, r });
 
-	for (int dx = -tileRadius; dx <= tileRadius; ++dx)
+	for (int cy = first.y; cy <= last.y; ++cy)
 	{
-		for (int dy = -tileRadius; dy <= tileRadius; ++dy)
+		for (int cx = first.x; cx <= last.x; ++cx)
 		{
-			sf::Vector2i tile = centerTile + sf::Vector2i(dx, dy);
-			sf::Vector2i tileWorldPos = tileToWorld(tile);
-			float dist = std::hypot(tileWorldPos.x - pos.x, tileWorldPos.y - pos.y);
+			const Chunk* chunk = c_chunks.find({ cx, cy });
+			if (!chunk)
+				continue;
+
+			sf::Vector2i origin = tileToWorld(chunk->firstTile());
+			long long dx = std::max({ origin.x - pos.x, 0, pos.x - (origin.x + chunk_px) });
+			long long dy = std::max({ origin.y - pos.y, 0, pos.y - (origin.y + chunk_px) });
+			long long dist = dx * dx + dy * dy;
+
+			if (dist > radius_sq)
+				continue;
+
+			// Whole chunk was already inside the previous circle
+			if (seen_from)
+			{
+				long long fx = std::max(std::abs(origin.x - seen_from->x), std::abs(origin.x + chunk_px - seen_from->x));
+				long long fy = std::max(std::abs(origin.y - seen_from->y), std::abs(origin.y + chunk_px - seen_from->y));
+
+				if (fx * fx + fy * fy <= radius_sq)
+					continue;
+			}
+
+			candidates.push_back({ dist, chunk });
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::array<long long, ElementsCount> best;
+	std::array<sf::Vector2i, ElementsCount> found;
+	best.fill(radius_sq + 1);
+
+	int tile_px = getTileSize();
+
+	// Columns of the tiles whose center lies on the chord of a circle, on the row dy away from its center. Exact, so
+	// the part of a row already seen can be cut out with it. Empty when lo > hi.
+	auto chord = [tile_px, radius_sq](int center_x, long long dy) -> std::pair<int, int>
+	{
+		long long rest = radius_sq - dy * dy;
+		if (rest < 0)
+			return { 1, 0 };
+
+		long long half = static_cast<long long>(std::sqrt(static_cast<double>(rest)));
+		while (half * half > rest)
+			--half;
+		while ((half + 1) * (half + 1) <= rest)
+			++half;
+
+		int h = static_cast<int>(half);
+		return { -floorDiv(h - center_x + tile_px / 2, tile_px), floorDiv(center_x + h - tile_px / 2, tile_px) };
+	};
+
+	// Runs of tile indices to scan in the current chunk, first and last included. Scratch space of the caller's thread
+	thread_local std::vector<std::pair<std::uint16_t, std::uint16_t>> runs;
+
+	for (const auto& [chunk_dist, chunk] : candidates)
+	{
+		int tps = chunk->tiles_per_side;
+		sf::Vector2i first_tile = chunk->firstTile();
+
+		// Rows of the chunk crossed by the circle
+		int row_first = std::clamp(worldToTile(pos - sf::Vector2i{ 0, r }).y - first_tile.y, 0, tps - 1);
+		int row_last = std::clamp(worldToTile(pos + sf::Vector2i{ 0, r }).y - first_tile.y, 0, tps - 1);
+
+		runs.clear();
+
+		auto addRun = [tps](int row, int col0, int col1)
+		{
+			runs.push_back({ static_cast<std::uint16_t>(row * tps + col0), static_cast<std::uint16_t>(row * tps + col1) });
+		};
+
+		for (int row = row_first; row <= row_last; ++row)
+		{
+			int center_y = getTileCenter(first_tile + sf::Vector2i{ 0, row }).y;
+
+			auto [lo, hi] = chord(pos.x, center_y - pos.y);
+			lo = std::max(lo - first_tile.x, 0);
+			hi = std::min(hi - first_tile.x, tps - 1);
 
-			if (dist > radius)
+			if (lo > hi)
 				continue;
 
-			sf::Color color = getBiomeColor(tileWorldPos);
+			// Columns inside the previous circle are cut out, up to two runs are left
+			auto [seen_lo, seen_hi] = seen_from ? chord(seen_from->x, center_y - seen_from->y) : std::pair<int, int>{ 1, 0 };
+			seen_lo -= first_tile.x;
+			seen_hi -= first_tile.x;
 
-			for (const auto& [element, biomeColor] : m_biomes)
+			if (seen_lo > seen_hi)
 			{
-				if ((element == Elements::ocean || element == Elements::hill) && color == biomeColor)
+				addRun(row, lo, hi);
+				continue;
+			}
+
+			if (lo < seen_lo)
+				addRun(row, lo, std::min(hi, seen_lo - 1));
+			if (hi > seen_hi)
+				addRun(row, std::max(lo, seen_hi + 1), hi);
+		}
+
+		if (runs.empty())
+			continue;
+
+		for (std::size_t el = 0; el < ElementsCount; ++el)
+		{
+			// A closer one was already found
+			if (chunk_dist >= best[el])
+				continue;
+
+			const auto& tiles = chunk->resources[el];
+
+			for (const auto& [run_first, run_last] : runs)
+			{
+				auto begin = std::lower_bound(tiles.begin(), tiles.end(), run_first);
+				auto end = std::upper_bound(begin, tiles.end(), run_last);
+
+				for (auto it = begin; it != end; ++it)
 				{
-					auto it = closest.find(element);
-					if (it == closest.end() || dist < it->second.first)
-					{
-						closest[element] = { dist, tileWorldPos }; // store world coords
-					}
-					break; // biome found → skip rest
+					sf::Vector2i tile = getTileCenter(first_tile + sf::Vector2i{ *it % tps, *it / tps });
+
+					long long dx = tile.x - pos.x;
+					long long dy = tile.y - pos.y;
+					long long dist = dx * dx + dy * dy;
+
+					if (dist >= best[el])
+						continue;
+
+					best[el] = dist;
+					found[el] = tile;
 				}
 			}
 		}
 	}
 
-	// Convert to final result (only closest of each type)
 	std::unordered_map<Elements, sf::Vector2i> resources;
-	for (const auto& [element, pair] : closest)
+	for (std::size_t el = 0; el < ElementsCount; ++el)
 	{
-		resources[element] = pair.second;
+		if (best[el] <= radius_sq)
+			resources[static_cast<Elements>(el)] = found[el];
 	}
 	return resources;
 }
 
-// Return the cost of the tile position.
-float MapGenerator::getTileCost(const sf::Vector2i& pos)
+// Return the speed multiplier of the tile position.
+float MapGenerator::getTileCost(const sf::Vector2i& pos) const
 {
-	sf::Vector2i chunkPos = getNextChunkPosition(pos, c_chunk_size * c_chunk_size);
-
-	auto it = c_chunks.find(chunkPos);
-	if (it == c_chunks.end() || !it->second)
+	auto chunk = findChunk(pos);
+	if (!chunk)
 	{
-		return 0; // No chunk found, return the input as fallback
+		return 0; // No chunk found, can't move
 	}
 
-	// Optional: snap pos to the center of the nearest tile
-	sf::Vector2i tile
-	{ 
-		pos.x / m_tile_size_px * m_tile_size_px + m_tile_size_px / 2, 
-		pos.y / m_tile_size_px * m_tile_size_px + m_tile_size_px / 2 
-	};
+	sf::Vector2i local = worldToTile(pos) - chunk->firstTile();
+
+	return getElementSpeed(chunk->tiles[local.y * chunk->tiles_per_side + local.x]);
+}
 
-	sf::Color tileColor{ getBiomeColor(tile) };
+/*
+*	Copy the step costs of a rectangle of tiles from the resident chunks.
+*/
+MapGenerator::CostGrid MapGenerator::buildCostGrid(const sf::IntRect& tiles) const
+{
+	CostGrid grid;
+	grid.origin = tiles.position;
+	grid.size = tiles.size;
+	grid.costs.assign(static_cast<std::size_t>(tiles.size.x) * tiles.size.y, 0);
 
-	if (tileColor == m_biomes[Elements::hill])
-		return 1;
-	if (tileColor == m_biomes[Elements::forest])
-		return 0.8;
-	if (tileColor == m_biomes[Elements::sand])
-		return 0.5;
-	if (tileColor == m_biomes[Elements::muntain])
-		return 0.5;
-	if (tileColor == m_biomes[Elements::snow] || tileColor == m_biomes[Elements::ocean])
-		return 0.3;
+	int tiles_per_chunk = c_chunk_tiles;
 
-	
-	return 0;
+	sf::Vector2i first	= tileToChunk(tiles.position);
+	sf::Vector2i last	= tileToChunk(tiles.position + tiles.size - sf::Vector2i{ 1, 1 });
+
+	for (int cy = first.y; cy <= last.y; ++cy)
+	{
+		for (int cx = first.x; cx <= last.x; ++cx)
+		{
+			const Chunk* resident = c_chunks.find({ cx, cy });
+			if (!resident)
+				continue;
+
+			const Chunk& chunk = *resident;
+
+			// Overlap between the chunk and the rectangle, in world tiles
+			int x0 = std::max(tiles.position.x, cx * tiles_per_chunk);
+			int y0 = std::max(tiles.position.y, cy * tiles_per_chunk);
+			int x1 = std::min(tiles.position.x + tiles.size.x, (cx + 1) * tiles_per_chunk);
+			int y1 = std::min(tiles.position.y + tiles.size.y, (cy + 1) * tiles_per_chunk);
+
+			for (int ty = y0; ty < y1; ++ty)
+			{
+				for (int tx = x0; tx < x1; ++tx)
+				{
+					Elements el = chunk.tiles[(ty - cy * tiles_per_chunk) * chunk.tiles_per_side + (tx - cx * tiles_per_chunk)];
+					grid.costs[static_cast<std::size_t>(ty - grid.origin.y) * grid.size.x + (tx - grid.origin.x)] = getElementStepCost(el);
+				}
+			}
+		}
+	}
+
+	return grid;
 }
 
 
 //Cambia il colore di una tile specifica nella mappa.
 bool MapGenerator::setTileColor(const sf::Vector2i& pos, const Elements& new_element)
 {
-	sf::Vector2i chunkPos = getNextChunkPosition(
-		sf::Vector2i(static_cast<int>(pos.x), static_cast<int>(pos.y)),
-		c_chunk_size * c_chunk_size
-	);
-
-	auto it = c_chunks.find(chunkPos);
-	if (it == c_chunks.end() || !it->second)
+	auto chunk = findChunk(pos);
+	if (!chunk)
 		return false;
 
-	// Find world tile and biome color
-	sf::Vector2i tile = worldToTile(pos);
-
 	// Trova la tile corrispondente nel chunk
-	auto& chunk = it->second;
-	for (auto& [key, val] : chunk->tile_types)
+	sf::Vector2i local = worldToTile(pos) - chunk->firstTile();
+	std::uint16_t index = static_cast<std::uint16_t>(local.y * chunk->tiles_per_side + local.x);
+	Elements& val = chunk->tiles[index];
+
+	if (val == new_element)
+		return true;
+
+	LOG_DEBUG("Tile updated from {} to {} ", static_cast<int>(val), static_cast<int>(new_element));
+
+	// Keep the resources index sorted
+	auto& old_list = chunk->resources[static_cast<std::size_t>(val)];
+	auto& new_list = chunk->resources[static_cast<std::size_t>(new_element)];
+	old_list.erase(std::lower_bound(old_list.begin(), old_list.end(), index));
+	new_list.insert(std::lower_bound(new_list.begin(), new_list.end(), index), index);
+
+	// Keep the land list in sync for sampling
+	if (isWalkable(val) != isWalkable(new_element))
 	{
-		if (static_cast<int>(key.x) == static_cast<int>(tile.x) &&
-			static_cast<int>(key.y) == static_cast<int>(tile.y))
+		// Sorted too, sampling takes runs of it by row
+		auto& land = chunk->land_tiles;
+		if (isWalkable(new_element))
+			land.insert(std::lower_bound(land.begin(), land.end(), index), index);
+		else
+			land.erase(std::lower_bound(land.begin(), land.end(), index));
+	}
+
+	val = new_element;
+	chunk->unload = false; // Edited chunks stay resident
+	stampChunk(*chunk);
+	++c_terrain_version;
+
+	return true;
+}
+
+/*
+*	Mark the chunk under pos as used by an entity, it won't be evicted for a while.
+*/
+void MapGenerator::referenceChunk(const sf::Vector2i& pos)
+{
+	if (auto chunk = findChunk(pos))
+		chunk->last_referenced = i_frames;
+}
+
+/*
+*	Bounding box of the resident chunks, in tiles.
+*/
+sf::IntRect MapGenerator::getResidentTiles() const
+{
+	if (c_chunks.empty())
+		return sf::IntRect{};
+
+	sf::Vector2i min{ std::numeric_limits<int>::max(), std::numeric_limits<int>::max() };
+	sf::Vector2i max{ std::numeric_limits<int>::min(), std::numeric_limits<int>::min() };
+
+	for (const auto& [coord, chunk] : c_chunks.items())
+	{
+		min.x = std::min(min.x, coord.x);
+		min.y = std::min(min.y, coord.y);
+		max.x = std::max(max.x, coord.x);
+		max.y = std::max(max.y, coord.y);
+	}
+
+	sf::Vector2i first	= min * c_chunk_tiles;
+	sf::Vector2i last	= (max + sf::Vector2i{ 1, 1 }) * c_chunk_tiles;
+
+	return sf::IntRect{ first, last - first };
+}
+
+/*
+*	World tiles of an element inside a rectangle of tiles, read from the chunk resource lists.
+*/
+std::vector<sf::Vector2i> MapGenerator::getElementTiles(Elements el, const sf::IntRect& tiles) const
+{
+	std::vector<sf::Vector2i> found;
+
+	int tiles_per_chunk = c_chunk_tiles;
+
+	sf::Vector2i first	= tileToChunk(tiles.position);
+	sf::Vector2i last	= tileToChunk(tiles.position + tiles.size - sf::Vector2i{ 1, 1 });
+
+	for (int cy = first.y; cy <= last.y; ++cy)
+	{
+		for (int cx = first.x; cx <= last.x; ++cx)
 		{
-			LOG_DEBUG("Tile updated from {} to {} ", static_cast<int>(val), static_cast<int>(new_element));
+			const Chunk* resident = c_chunks.find({ cx, cy });
+			if (!resident)
+				continue;
+
+			const Chunk& chunk = *resident;
 
-			val = new_element;
+			for (std::uint16_t index : chunk.resources[static_cast<std::size_t>(el)])
+			{
+				sf::Vector2i tile{ cx * tiles_per_chunk + index % chunk.tiles_per_side, cy * tiles_per_chunk + index / chunk.tiles_per_side };
 
-			return true;
+				if (tiles.contains(tile))
+					found.push_back(tile);
+			}
 		}
 	}
-	return false;
+
+	return found;
+}
+
+/*
+*	Revision of the resident chunk at the chunk coordinate (in chunks, not px), 0 if it isn't loaded.
+*/
+std::uint64_t MapGenerator::getChunkRevision(const sf::Vector2i& chunk) const
+{
+	const Chunk* found = c_chunks.find(chunk);
+	return found ? found->revision : 0;
+}
+
+/*
+*	Chunks (chunk coordinates) loaded or edited after the revision since, each once. Returns false when the log doesn't
+*	reach back that far, the caller has to assume everything changed.
+*/
+bool MapGenerator::getChunkChanges(std::uint64_t since, std::vector<sf::Vector2i>& changed) const
+{
+	changed.clear();
+
+	if (since >= c_chunk_revisions)
+		return true;
+
+	// Stamps are consecutive, the log is complete if it holds the one right after since
+	if (c_chunk_changes.empty() || c_chunk_changes.front().first > since + 1)
+		return false;
+
+	auto first = std::upper_bound(c_chunk_changes.begin(), c_chunk_changes.end(), since, [](std::uint64_t stamp, const auto& change)
+	{
+		return stamp < change.first;
+	});
+
+	std::vector<ChunkKey> keys;
+	keys.reserve(static_cast<std::size_t>(c_chunk_changes.end() - first));
+
+	for (auto it = first; it != c_chunk_changes.end(); ++it)
+		keys.push_back(toChunkKey(it->second));
+
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	changed.reserve(keys.size());
+	for (ChunkKey key : keys)
+		changed.push_back(fromChunkKey(key));
+
+	return true;
+}
+
+/*
+*	Give the chunk a new revision and log the change.
+*/
+void MapGenerator::stampChunk(Chunk& chunk)
+{
+	chunk.revision = logChunkChange(chunk.coord);
+}
+
+/*
+*	New revision stamp for a change of the chunk at the coordinate. The older half of the log is dropped when it is full.
+*/
+std::uint64_t MapGenerator::logChunkChange(const sf::Vector2i& coord)
+{
+	++c_chunk_revisions;
+
+	if (c_chunk_changes.size() >= c_change_log)
+		c_chunk_changes.erase(c_chunk_changes.begin(), c_chunk_changes.begin() + static_cast<std::ptrdiff_t>(c_change_log / 2));
+
+	c_chunk_changes.emplace_back(c_chunk_revisions, coord);
+	return c_chunk_revisions;
+}
+
+/*
+*	Return the resident chunk containing the world position, if any.
+*/
+MapGenerator::Chunk* MapGenerator::findChunk(const sf::Vector2i& pos) const
+{
+	return c_chunks.find(worldToChunk(pos));
+}
+
+/*
+*	Chunks holding edits or recently used by entities can't be evicted.
+*/
+bool MapGenerator::isChunkPinned(const Chunk& chunk) const
+{
+	if (!chunk.unload)
+		return true;
+
+	return chunk.last_referenced >= 0 && i_frames - chunk.last_referenced <= c_pin_frames;
 }
 
 /*
-*	Translate coordinates
+*	Translate coordinates, see Coordinates.h. The px of a tile all map to it, also left of and above the origin.
 */
 sf::Vector2i MapGenerator::worldToTile(sf::Vector2i pos) const 
 {
-	return sf::Vector2i
-	(
-		static_cast<int>(pos.x) / m_tile_size_px,
-		static_cast<int>(pos.y) / m_tile_size_px
-	);
+	return floorDiv(pos, m_tile_size_px);
 }
 
 sf::Vector2i MapGenerator::tileToWorld(sf::Vector2i tile) const 
@@ -563,4 +1342,112 @@ sf::Vector2i MapGenerator::tileToWorld(sf::Vector2i tile) const
 		tile.x * m_tile_size_px,
 		tile.y * m_tile_size_px
 	);
-}
\ No newline at end of file
+}
+
+sf::Vector2i MapGenerator::tileToChunk(sf::Vector2i tile) const
+{
+	return floorDiv(tile, c_chunk_tiles);
+}
+
+sf::Vector2i MapGenerator::worldToChunk(sf::Vector2i pos) const
+{
+	return tileToChunk(worldToTile(pos));
+}
+
+/*
+*	Centre of a tile in world px.
+*/
+sf::Vector2i MapGenerator::getTileCenter(const sf::Vector2i& tile) const
+{
+	return tileToWorld(tile) + sf::Vector2i{ m_tile_size_px / 2, m_tile_size_px / 2 };
+}
+
+/*
+*	Generation parameters and edited chunks, for a save. Edits of a loaded save that weren't generated yet are kept too.
+*/
+MapGenerator::SaveState MapGenerator::getSaveState() const
+{
+	SaveState state;
+	state.seed					= m_seed;
+	state.cont_multiplier		= m_cont_multiplier;
+	state.mineral_multiplier	= m_mineral_multiplier;
+	state.cont_freq				= m_cont_freq;
+	state.warp_freq				= m_warp_freq;
+	state.mineral_freq			= m_mineral_freq;
+	state.tiles_per_side		= getChunkTiles();
+	state.thresholds			= m_thresholds;
+
+	for (const auto& [coord, chunk] : c_chunks.items())
+	{
+		if (!chunk->unload)
+			state.edited.emplace_back(coord, chunk->tiles);
+	}
+
+	for (const auto& [key, tiles] : c_saved_tiles)
+		state.edited.emplace_back(fromChunkKey(key), tiles);
+
+	return state;
+}
+
+/*
+*	Replace the world with a saved one. Chunks are generated again, the edited ones get their saved tiles on arrival.
+*/
+void MapGenerator::loadSaveState(const SaveState& state)
+{
+	m_seed					= state.seed;
+	m_cont_multiplier		= state.cont_multiplier;
+	m_mineral_multiplier	= state.mineral_multiplier;
+	m_cont_freq				= state.cont_freq;
+	m_warp_freq				= state.warp_freq;
+	m_mineral_freq			= state.mineral_freq;
+	m_thresholds			= state.thresholds;
+
+	// Nothing of the old world is kept, chunks still in the pool are dropped on arrival
+	for (const auto& [coord, chunk] : c_chunks.items())
+		releaseChunk(chunk);
+
+	// Everything changed, readers of the log start over
+	c_chunk_changes.clear();
+	++c_chunk_revisions;
+
+	c_chunks.clear();
+	c_visible.clear();
+	c_visible_range = {};
+	c_resident_bytes = 0;
+
+	setNoises();
+	print();
+
+	for (const auto& [coord, tiles] : state.edited)
+	{
+		if (tiles.size() == static_cast<std::size_t>(getChunkTiles() * getChunkTiles()))
+			c_saved_tiles[toChunkKey(coord)] = tiles;
+	}
+}
+
+/*
+*	Overwrite the tiles of a freshly generated chunk and rebuild its indices. The chunk becomes pinned like any edited one.
+*/
+void MapGenerator::applySavedTiles(Chunk& chunk, const std::vector<Elements>& tiles)
+{
+	if (tiles.size() != chunk.tiles.size())
+		return;
+
+	chunk.tiles = tiles;
+	chunk.land_tiles.clear();
+
+	for (auto& list : chunk.resources)
+		list.clear();
+
+	for (std::size_t i = 0; i < chunk.tiles.size(); ++i)
+	{
+		std::uint16_t index = static_cast<std::uint16_t>(i);
+
+		chunk.resources[static_cast<std::size_t>(chunk.tiles[i])].push_back(index);
+		if (isWalkable(chunk.tiles[i]))
+			chunk.land_tiles.push_back(index);
+	}
+
+	chunk.unload = false;
+	++c_terrain_version;
+}
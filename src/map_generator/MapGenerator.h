@@ -1,16 +1,10 @@
 #pragma once
 
-// CHUNK HASH			///////////////////////////
-struct Vector2iHash {
-	std::size_t operator()(const sf::Vector2i& v) const noexcept {
-		std::size_t h1 = std::hash<int>()(v.x);
-		std::size_t h2 = std::hash<int>()(v.y);
-		return h1 ^ (h2 << 1);
-	}
-};
+#include "Coordinates.h"
+#include "ChunkGrid.h"
 
 // ELEMENTS ENUM		///////////////////////////
-enum class Elements
+enum class Elements : std::uint8_t
 {
 	very_deep_ocean = 0,
 	deep_ocean,
@@ -29,43 +23,174 @@ enum class Elements
 	test
 };
 
+constexpr std::size_t ElementsCount = static_cast<std::size_t>(Elements::test) + 1;
+
+// Entities can't walk on water
+inline bool isWalkable(Elements el)
+{
+	return el != Elements::very_deep_ocean && el != Elements::deep_ocean && el != Elements::ocean;
+}
+
+// Movement speed multiplier on a tile, 0 can't be crossed. Minerals move like the biome they appear in
+inline float getElementSpeed(Elements el)
+{
+	switch (el)
+	{
+	case Elements::hill:
+	case Elements::clay:	return 1.f;
+	case Elements::forest:
+	case Elements::iron:	return 0.8f;
+	case Elements::sand:
+	case Elements::muntain:
+	case Elements::silver:	return 0.5f;
+	case Elements::snow:
+	case Elements::ocean:	return 0.3f;
+	default:				return 0.f;
+	}
+}
+
+// Pathfinding cost of stepping on a tile (10 on the fastest tiles), 0 is blocked
+inline std::uint8_t getElementStepCost(Elements el)
+{
+	float speed = getElementSpeed(el);
+	return speed > 0.f ? static_cast<std::uint8_t>(std::lround(10.f / speed)) : 0;
+}
+
 // MAP GENERATOR CLASS	///////////////////////////
 class MapGenerator
 {
 
 public:
+	// Tiles per side of a chunk at most, tile indices are 16 bit (MaxChunkTiles * MaxChunkTiles - 1 fits)
+	static constexpr int MaxChunkTiles = 256;
+
 	struct Chunk {
-		sf::Vector2i	position;			// top left position of chunk
-		sf::VertexArray vertices;			// the map in vertices ready to draw
-		std::unordered_map<sf::Vector2i, Elements, Vector2iHash> tile_types;
-		bool unload{ true };
+		sf::Vector2i	coord;				// chunk coordinate
+		sf::VertexArray vertices;			// the map in vertices ready to draw, built when the chunk gets close to the view
+		std::uint64_t mesh_revision{ 0 };	// revision the vertices were built from, the mesh is outdated when it differs
+		bool mesh_pending{ false };			// a mesh job was submitted and hasn't arrived yet
+		bool retired{ false };				// left the map while a mesh job was running, back to the pool when it arrives
+		int							tiles_per_side{ 0 };
+		std::vector<Elements>		tiles;				// row major, tiles_per_side * tiles_per_side
+		std::vector<std::uint16_t>	land_tiles;			// sorted indices of walkable tiles, for sampling
+		std::array<std::vector<std::uint16_t>, ElementsCount> resources;	// sorted tile indices of each element
+		bool unload{ true };				// false once the chunk holds edits
+		int last_seen{ 0 };					// last frame the chunk was in the draw area (or arrived)
+		int last_referenced{ -1 };			// last frame an entity was on or heading to the chunk
+		std::size_t memory{ 0 };			// estimated bytes held by the chunk
+		int epoch{ 0 };						// generation parameters the chunk was built with
+		std::uint64_t revision{ 0 };		// unique stamp, renewed when the chunk becomes resident or is edited
+
+		// MESH JOB variables, owned by the worker while mesh_pending is set
+		std::vector<Elements>	mesh_tiles;				// snapshot of the tiles
+		sf::VertexArray			mesh_vertices;			// back buffer, swapped with vertices on arrival
+		std::uint64_t			mesh_built_from{ 0 };	// revision of the snapshot
+
+		// First tile of the chunk, in world tiles
+		sf::Vector2i	firstTile()	const	{ return coord * tiles_per_side; }
 
 		// DEBUG variables
 		//std::vector<std::shared_ptr<sf::Text>>	d_noise;
 	};
 
-	using ChunkMap = std::unordered_map<sf::Vector2i, std::shared_ptr<Chunk>, Vector2iHash>;
+	// Resident chunks by chunk coordinate, owned by the pool
+	using ChunkMap = ChunkGrid<Chunk>;
+
+	// Step costs of a rectangle of tiles, copied for the pathfinding workers. Unloaded tiles are blocked (0).
+	struct CostGrid {
+		sf::Vector2i				origin{ 0, 0 };		// first tile
+		sf::Vector2i				size{ 0, 0 };		// in tiles
+		std::vector<std::uint8_t>	costs;				// row major
+
+		bool contains(const sf::Vector2i& tile) const
+		{
+			return tile.x >= origin.x && tile.y >= origin.y && tile.x < origin.x + size.x && tile.y < origin.y + size.y;
+		}
+	};
+
+	// Generation parameters. Immutable once published, workers capture one per chunk.
+	struct NoiseSettings {
+		int				epoch{ 0 };			// increases with every published change
+		int				seed{ 0 };
+
+		float			cont_multiplier{ 0.f };
+		float			mineral_multiplier{ 0.f };
+
+		FastNoiseLite	noise_continent;
+		FastNoiseLite	noise_wrap;
+		FastNoiseLite	noise_mineral;
+
+		std::array<sf::Color, ElementsCount>	biomes{};
+		std::array<float, ElementsCount>		thresholds{};
+
+		const sf::Color&	biome(Elements el)		const { return biomes[static_cast<std::size_t>(el)]; }
+		float				threshold(Elements el)	const { return thresholds[static_cast<std::size_t>(el)]; }
+	};
+
+	// What a save needs to rebuild the same world: the generation parameters and the tiles of the edited chunks
+	struct SaveState {
+		int				seed{ 0 };
+		float			cont_multiplier{ 0.f };
+		float			mineral_multiplier{ 0.f };
+		double			cont_freq{ 0.0 };
+		double			warp_freq{ 0.0 };
+		double			mineral_freq{ 0.0 };
+		int				tiles_per_side{ 0 };
+
+		std::array<float, ElementsCount>								thresholds{};
+		std::vector<std::pair<sf::Vector2i, std::vector<Elements>>>	edited;		// chunk coordinate, row major tiles
+	};
 
 private:
 	// CHUNK variables
 	ChunkMap	c_chunks;
-	int			c_chunk_size;
+	std::unordered_set<ChunkKey, ChunkKeyHash>	c_chunks_pending;	// submitted to the pool, not arrived yet
+	int			c_chunk_tiles;				// tiles per side of a chunk
 	int			c_chunk_margin;
+	float		c_prefetch_lookahead;		// seconds of camera travel to generate ahead
+	std::size_t	c_memory_budget;			// bytes of resident chunks before eviction starts
+	int			c_unload_hysteresis;		// chunks past the active area before a chunk can be evicted
+	int			c_pin_frames{ 120 };		// frames an entity reference keeps a chunk loaded
+	int			c_sample_attempts{ 16 };	// tries to find a walkable tile before giving up
+	std::size_t	c_resident_bytes{ 0 };		// kept up to date as chunks come and go
+	std::uint64_t c_terrain_version{ 0 };	// bumped when tiles change (edits, new parameters)
+	std::uint64_t c_chunk_revisions{ 0 };	// last stamp given to a chunk
+	std::vector<std::pair<std::uint64_t, sf::Vector2i>>	c_chunk_changes;	// stamp and chunk coordinate (loaded, edited or unloaded), oldest first
+	std::size_t	c_change_log{ 4096 };		// changes kept for getChunkChanges()
+	std::unordered_map<ChunkKey, std::vector<Elements>, ChunkKeyHash>	c_saved_tiles;	// edits of a loaded save, applied when the chunk arrives
+	bool		c_build_meshes{ true };		// false when nothing is drawn, chunks only hold their tiles
+	bool		c_stale_resident{ false };	// chunks built with older parameters are still resident
+
+	// POOL variables. Every chunk ever made lives here, and is recycled with the capacity of its buffers
+	std::vector<std::unique_ptr<Chunk>>	c_pool;
+	std::vector<Chunk*>					c_pool_free;
+
+	// Draw area, updated as the view moves
+	sf::IntRect							c_visible_range;	// in chunk coordinates
+	std::vector<Chunk*>					c_visible;			// resident chunks inside c_visible_range
+
+	// Per frame lists, kept between frames so they don't allocate once they are big enough
+	std::vector<Chunk*>					c_arrived;
+	std::vector<Chunk*>					c_evictable;
+	std::vector<sf::Vector2i>			c_missing;			// chunk coordinates
 
 	// SHARED variables
-	std::atomic<sf::Vector2i>	s_camera_position;
-	std::atomic<sf::Vector2i>	s_view_size;
+	std::atomic<sf::Vector2f>	s_camera_velocity{ sf::Vector2f{ 0.f, 0.f } };
+	std::atomic<float>			s_zoom_trend{ 0.f };
 	std::atomic<bool>			s_running{ true };
 	
 	// THREAD Variables
-	BS::thread_pool<>							t_threads{ 3 };
-	std::mutex									t_mutex;
-	SharedContainer<std::shared_ptr<Chunk>>		tc_chunks_ready;
-	SharedContainer<sf::Vector2i>				tc_chunks_in_queue;
+	BS::thread_pool<>							t_threads;
+	std::size_t									t_max_pending;		// chunk tasks allowed in flight
+	std::size_t									t_meshes_pending{ 0 };	// mesh tasks in flight
+	std::uint64_t								t_submitted{ 0 };	// chunk tasks ever submitted, ids for the trace
+	SharedContainer<Chunk*>						tc_chunks_ready;
+	SharedContainer<Chunk*>						tc_meshes_ready;
 	
-	// MAP Variables
+	// MAP Variables (main thread only, published through setNoises)
 	int					m_tile_size_px;
 	int					m_seed;
+	int					m_epoch{ 0 };
 
 	float				m_cont_multiplier;
 	float				m_mineral_multiplier;
@@ -74,12 +199,11 @@ private:
 	double				m_warp_freq;
 	double				m_mineral_freq;
 
-	FastNoiseLite		m_noise_continent;
-	FastNoiseLite		m_noise_wrap;
-	FastNoiseLite		m_noise_mineral;
+	std::array<sf::Color, ElementsCount>	m_biomes{};
+	std::array<float, ElementsCount>		m_thresholds{};
 
-	std::unordered_map<Elements, sf::Color>		m_biomes;
-	std::unordered_map<Elements, float>			m_thresholds;
+	// Current snapshot, swapped atomically
+	std::shared_ptr<const NoiseSettings>	m_settings;
 
 	// INHERITED variables
 	int& i_frames;
@@ -90,14 +214,38 @@ private:
 	bool		d_wire_frame{ false };
 
 	// GENERATE MAP SUPPORT FUNCTIONS
-	std::shared_ptr<Chunk>		generateChunk(const int height, const int width, const sf::Vector2i& position);
-	sf::Color					getBiomeColor(const sf::Vector2i& coord);
-	void						startChunksGenerator();
+	void						classifyChunk(const NoiseSettings& settings, Chunk& chunk) const;
+	void						buildMesh(const NoiseSettings& settings, const std::vector<Elements>& tiles, int tiles_per_side, const sf::Vector2i& coord, sf::VertexArray& vertices) const;
+	Elements					getBiomeElement(const NoiseSettings& settings, const sf::Vector2i& coord) const;
+	sf::Color					getBiomeColor(const NoiseSettings& settings, const sf::Vector2i& coord) const;
+	Chunk*						findChunk(const sf::Vector2i& pos) const;
+	std::shared_ptr<const NoiseSettings> getSettings() const { return std::atomic_load(&m_settings); }
+	void						generateChunkTask(Chunk* chunk);
+	void						buildMeshTask(Chunk* chunk);
+	void						submitMeshes(std::vector<Chunk*>& chunks, const sf::Vector2i& center_tile);
+	sf::IntRect					getChunkRange(const sf::IntRect& area) const;
+	sf::IntRect					getVisibleRange(const sf::IntRect& viewBounds) const;
+	void						updateVisible(const sf::IntRect& range);
+	void						evictChunks(const sf::IntRect& keep_range);
+	void						dropStaleChunks(const sf::IntRect& keep_range);
+	void						unloadChunk(Chunk* chunk);
+	Chunk*						acquireChunk(const sf::Vector2i& coord);
+	void						releaseChunk(Chunk* chunk);
+	static std::size_t			getChunkMemory(const Chunk& chunk);
+	sf::IntRect					getPrefetchArea(const sf::IntRect& viewBounds) const;
+	bool						isChunkPinned(const Chunk& chunk) const;
+	void						stampChunk(Chunk& chunk);
+	std::uint64_t				logChunkChange(const sf::Vector2i& coord);
+	sf::Vector2i				getTileCenter(const sf::Vector2i& tile) const;
+	void						applySavedTiles(Chunk& chunk, const std::vector<Elements>& tiles);
+
+public:
 
+	// COORDINATES
 	sf::Vector2i worldToTile(sf::Vector2i pos) const;
 	sf::Vector2i tileToWorld(sf::Vector2i tile) const;
-
-public:
+	sf::Vector2i tileToChunk(sf::Vector2i tile) const;
+	sf::Vector2i worldToChunk(sf::Vector2i pos) const;
 
 	// RESET VARIABLE
 	bool m_reset{ false };
@@ -107,13 +255,13 @@ public:
 		: d_font(font)
 		, i_frames(frames)
 	{
-		// Create json
+		// Create json, comments document the keys
 		std::ifstream f(map_file);
-		nlohmann::json js_map = nlohmann::json::parse(f);
+		nlohmann::json js_map = nlohmann::json::parse(f, nullptr, true, true);
 
 		// Construct biomes and heights objs
 		for (auto& [key, value] : js_map["elements"].items()) {
-			m_biomes[static_cast<Elements>(std::stoi(key))] = {
+			m_biomes[static_cast<std::size_t>(std::stoi(key))] = {
 				static_cast<std::uint8_t>(value[0]),
 				static_cast<std::uint8_t>(value[1]),
 				static_cast<std::uint8_t>(value[2]),
@@ -121,14 +269,20 @@ public:
 		}
 
 		for (auto& [key, value] : js_map["heights"].items()) {
-			m_thresholds[static_cast<Elements>(std::stoi(key))] = value.get<float>();
+			m_thresholds[static_cast<std::size_t>(std::stoi(key))] = value.get<float>();
 		}
 
 		// Initiate variables
 		m_tile_size_px = js_map["tile_size"];
 		m_seed = Random::get(1, 1000000);
-		c_chunk_size = js_map["chunk_tile_size"];
+		int chunk_tiles = js_map["chunk_tile_size"];
+		c_chunk_tiles = std::clamp(chunk_tiles, 1, MaxChunkTiles);
+		if (c_chunk_tiles != chunk_tiles)
+			LOG_WARN("chunk_tile_size {} is out of range, using {} (1 to {}).", chunk_tiles, c_chunk_tiles, MaxChunkTiles);
 		c_chunk_margin = js_map["chunk_margin"];
+		c_prefetch_lookahead = static_cast<float>(js_map["prefetch_lookahead"]);
+		c_memory_budget = static_cast<std::size_t>(js_map["chunk_memory_budget_mb"]) * 1024 * 1024;
+		c_unload_hysteresis = js_map["chunk_unload_hysteresis"];
 
 		m_cont_multiplier = static_cast<float>(js_map["cont_multiplier"]);
 		m_mineral_multiplier = static_cast<float>(js_map["mineral_multiplier"]);
@@ -136,34 +290,33 @@ public:
 		m_warp_freq = static_cast<float>(js_map["warp_freq"]);
 		m_mineral_freq = static_cast<float>(js_map["mineral_freq"]);
 
-		// Set Noises
-		m_noise_continent.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
-		m_noise_continent.SetFractalType(FastNoiseLite::FractalType_FBm);
-
-		m_noise_wrap.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-		m_noise_wrap.SetFractalType(FastNoiseLite::FractalType_FBm);
+		// Publish first noise settings
+		setNoises();
 
-		m_noise_mineral.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-		m_noise_mineral.SetFractalType(FastNoiseLite::FractalType_FBm);
+		// Generator pool, one task per chunk. 0 threads means one per core, leaving the main thread free
+		unsigned int threads = js_map["generator_threads"];
+		if (threads == 0)
+			threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
 
-		setNoises();
+		t_threads.reset(threads, [](std::size_t index) { Trace::get().setThreadName("map worker " + std::to_string(index)); });
+		t_max_pending = threads * 4;
 
-		// Generate Thread
-		t_threads.submit_task([this] { fillQueueChunks(); }); // Find chunks to create.
-		t_threads.submit_task([this] { startChunksGenerator(); });
-		t_threads.submit_task([this] { startChunksGenerator(); });
+		LOG_INFO("Chunk generator threads: {}.", threads);
 	}
 
 	// DECONSTRUCTOR
 	~MapGenerator()
 	{
-		// Thread cleaning
+		// Thread cleaning, drop queued chunks and wait for the running ones
 		s_running = false;
+		t_threads.purge();
+		t_threads.wait();
 	}
 
 	// RENDERING
 	void render(const sf::IntRect& viewBounds, sf::RenderTarget& window);
-	void fillQueueChunks();
+	void fillQueueChunks(const sf::IntRect& viewBounds);
+	void waitForWorkers()								{ t_threads.wait(); }	// lockstep replays, every chunk lands on the next frame
 
 	// SETTERS
 	void setSeed(int seed = Random::get(1, 1000000))	{ m_seed = seed; }
@@ -177,6 +330,15 @@ public:
 	void setMineralMult(float mult)						{ m_mineral_multiplier = mult; }
 
 	bool setTileColor(const sf::Vector2i& pos, const Elements& new_element);
+	void loadSaveState(const SaveState& state);
+	void referenceChunk(const sf::Vector2i& pos);
+	void setMeshBuilding(bool status)					{ c_build_meshes = status; }	// headless runs only need the tiles
+
+	void setCameraMotion(const sf::Vector2f& velocity, float zoom_trend)
+	{
+		s_camera_velocity.store(velocity);
+		s_zoom_trend.store(zoom_trend);
+	}
 
 	// DEBUG
 	void setDebugNoiseView(bool status)					{ d_noise_val = status; }
@@ -194,10 +356,22 @@ public:
 	// GETTERS
 	int							getTileSize()				const	{ return m_tile_size_px; }
 	int							getSeed()					const	{ return m_seed; }
-	float						getTileCost(const sf::Vector2i& pos);
+	std::size_t					getResidentBytes()			const	{ return c_resident_bytes; }
+	float						getTileCost(const sf::Vector2i& pos) const;
+	std::uint64_t				getTerrainVersion()			const	{ return c_terrain_version; }
+	CostGrid					buildCostGrid(const sf::IntRect& tiles) const;
+	int							getChunkTiles()				const	{ return c_chunk_tiles; }
+	int							getChunkPx()				const	{ return c_chunk_tiles * m_tile_size_px; }
+	std::uint64_t				getChunkRevision(const sf::Vector2i& chunk) const;
+	std::uint64_t				getChunkRevisions()			const	{ return c_chunk_revisions; }
+	bool						getChunkChanges(std::uint64_t since, std::vector<sf::Vector2i>& changed) const;
+	bool						isResident(const sf::Vector2i& pos) const	{ return findChunk(pos) != nullptr; }
+	sf::IntRect					getResidentTiles()			const;
+	std::vector<sf::Vector2i>	getElementTiles(Elements el, const sf::IntRect& tiles) const;
+	SaveState					getSaveState()				const;
 	std::vector<std::string>						getPositionInfo(sf::Vector2i pos);
-	sf::Vector2i									getLocationWithinBound(sf::Vector2i& pos, float radius);
-	std::unordered_map<Elements, sf::Vector2i>		getResourcesWithinBoundary(sf::Vector2i& pos, float radius);
+	std::optional<sf::Vector2i>						getLocationWithinBound(const sf::Vector2i& pos, float radius, Random::Stream& rng) const;
+	std::unordered_map<Elements, sf::Vector2i>		getResourcesWithinBoundary(const sf::Vector2i& pos, float radius, const std::optional<sf::Vector2i>& seen_from = std::nullopt) const;
 
 	bool				getDebugNoiseStatus()		const	{ return d_noise_val; }
 	bool				getDebugWireFrame()			const	{ return d_wire_frame; }
@@ -0,0 +1,313 @@
+#include <pch.h>
+
+#include "ChunkGraph.h"
+
+/*
+*	Find the entrances on the four borders of a snapshot and the crossing costs between them.
+*/
+std::shared_ptr<const ChunkGraph::Piece> ChunkGraph::build(const Snapshot& snapshot) const
+{
+	auto piece		= std::make_shared<Piece>();
+	piece->chunk	= snapshot.chunk;
+	piece->stamps	= snapshot.stamps;
+
+	const auto& grid	= snapshot.grid;
+	const int tiles		= grid.size.x - 2;
+
+	auto cost = [&grid](const sf::Vector2i& local) { return grid.costs[local.y * grid.size.x + local.x]; };
+
+	// Openings are runs of tiles walkable on both sides. The neighbour scans the same two rows, so it finds the same entrances
+	auto scanBorder = [&](const sf::Vector2i& inside, const sf::Vector2i& outside, const sf::Vector2i& step)
+	{
+		auto addEntrance = [&](int k)
+		{
+			piece->entrances.push_back(Entrance{ grid.origin + inside + step * k, grid.origin + outside + step * k, cost(outside + step * k) });
+		};
+
+		int run = 0;
+		for (int k = 0; k <= tiles; ++k)
+		{
+			if (k < tiles && cost(inside + step * k) != 0 && cost(outside + step * k) != 0)
+			{
+				++run;
+				continue;
+			}
+
+			if (run >= c_long_entrance)
+			{
+				addEntrance(k - run);
+				addEntrance(k - 1);
+			}
+			else if (run > 0)
+			{
+				addEntrance(k - run + (run - 1) / 2);
+			}
+
+			run = 0;
+		}
+	};
+
+	scanBorder({ 1, 1 },		{ 1, 0 },			{ 1, 0 });	// top
+	scanBorder({ 1, tiles },	{ 1, tiles + 1 },	{ 1, 0 });	// bottom
+	scanBorder({ 1, 1 },		{ 0, 1 },			{ 0, 1 });	// left
+	scanBorder({ tiles, 1 },	{ tiles + 1, 1 },	{ 0, 1 });	// right
+
+	// Crossing costs, one flood per entrance
+	const std::size_t count = piece->entrances.size();
+	piece->costs.assign(count * count, Unreachable);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		std::vector<std::uint32_t> distances = flood(grid, piece->entrances[i].tile);
+
+		for (std::size_t j = 0; j < count; ++j)
+		{
+			sf::Vector2i local = piece->entrances[j].tile - grid.origin;
+			piece->costs[i * count + j] = distances[local.y * grid.size.x + local.x];
+		}
+	}
+
+	return piece;
+}
+
+std::shared_ptr<const ChunkGraph::Piece> ChunkGraph::find(const sf::Vector2i& chunk) const
+{
+	std::shared_lock lock(m_mutex);
+
+	auto it = m_pieces.find(chunk);
+	if (it == m_pieces.end())
+		return nullptr;
+
+	return it->second;
+}
+
+void ChunkGraph::insert(std::shared_ptr<const Piece> piece)
+{
+	std::unique_lock lock(m_mutex);
+
+	m_pieces[piece->chunk] = std::move(piece);
+}
+
+/*
+*	Drop the pieces that are no longer needed, e.g. their chunk was evicted.
+*/
+void ChunkGraph::prune(const std::function<bool(const Piece&)>& keep)
+{
+	std::unique_lock lock(m_mutex);
+
+	for (auto it = m_pieces.begin(); it != m_pieces.end(); )
+	{
+		if (keep(*it->second))
+			++it;
+		else
+			it = m_pieces.erase(it);
+	}
+}
+
+/*
+*	Dijkstra from a tile over the chunk of a snapshot (the ring is not entered). Returns the cost to every tile of the grid.
+*/
+std::vector<std::uint32_t> ChunkGraph::flood(const MapGenerator::CostGrid& grid, const sf::Vector2i& from)
+{
+	const int width = grid.size.x;
+	std::vector<std::uint32_t> distances(grid.costs.size(), Unreachable);
+
+	sf::Vector2i local = from - grid.origin;
+	if (local.x < 1 || local.y < 1 || local.x > width - 2 || local.y > grid.size.y - 2)
+		return distances;
+
+	using Node = std::pair<std::uint32_t, int>;	// cost, index
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node>> open;
+
+	distances[local.y * width + local.x] = 0;
+	open.push({ 0, local.y * width + local.x });
+
+	static const int dirs[8][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }, { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+	while (!open.empty())
+	{
+		auto [dist, current] = open.top();
+		open.pop();
+
+		if (dist > distances[current])
+			continue;
+
+		int cx = current % width;
+		int cy = current / width;
+
+		for (const auto& dir : dirs)
+		{
+			int nx = cx + dir[0];
+			int ny = cy + dir[1];
+
+			if (nx < 1 || ny < 1 || nx > width - 2 || ny > grid.size.y - 2)
+				continue;
+
+			int next = ny * width + nx;
+			std::uint32_t step = grid.costs[next];
+
+			if (step == 0)
+				continue;
+
+			// Diagonals need both sides free
+			if (dir[0] != 0 && dir[1] != 0)
+			{
+				if (grid.costs[cy * width + nx] == 0 || grid.costs[ny * width + cx] == 0)
+					continue;
+
+				step = step * 14 / 10;
+			}
+
+			if (dist + step < distances[next])
+			{
+				distances[next] = dist + step;
+				open.push({ dist + step, next });
+			}
+		}
+	}
+
+	return distances;
+}
+
+/*
+*	A* over the entrances of the given pieces. Returns the tiles where the route enters a new chunk, followed by the goal.
+*/
+std::optional<std::vector<sf::Vector2i>> ChunkGraph::search(const PieceMap& pieces, const Snapshot& start, const Snapshot& goal, const sf::Vector2i& from, const sf::Vector2i& to)
+{
+	auto start_piece	= pieces.find(start.chunk);
+	auto goal_piece		= pieces.find(goal.chunk);
+
+	if (start_piece == pieces.end() || goal_piece == pieces.end())
+		return std::nullopt;
+
+	// Flatten the entrances, the ones of a piece are contiguous
+	struct Node {
+		const Piece*	piece;
+		int				index;
+	};
+
+	// A corner tile has an entrance on both borders it touches, they are told apart by the side they face
+	struct Sides {
+		std::array<int, 4> ids{ -1, -1, -1, -1 };	// top, bottom, left, right
+	};
+
+	auto sideOf = [](const sf::Vector2i& tile, const sf::Vector2i& outside)
+	{
+		sf::Vector2i d = outside - tile;
+		return d.y < 0 ? 0 : d.y > 0 ? 1 : d.x < 0 ? 2 : 3;
+	};
+
+	std::vector<Node> nodes;
+	std::unordered_map<sf::Vector2i, Sides, Vector2iHash> by_tile;
+
+	for (const auto& [chunk, piece] : pieces)
+	{
+		for (int i = 0; i < static_cast<int>(piece->entrances.size()); ++i)
+		{
+			const Entrance& entrance = piece->entrances[i];
+			by_tile[entrance.tile].ids[sideOf(entrance.tile, entrance.outside)] = static_cast<int>(nodes.size());
+			nodes.push_back(Node{ piece.get(), i });
+		}
+	}
+
+	const int start_id	= static_cast<int>(nodes.size());
+	const int goal_id	= start_id + 1;
+
+	// Costs from the start and to the goal inside their own chunks
+	std::vector<std::uint32_t> from_start	= flood(start.grid, from);
+	std::vector<std::uint32_t> to_goal		= flood(goal.grid, to);
+
+	auto local = [](const MapGenerator::CostGrid& grid, const sf::Vector2i& tile) { return (tile.y - grid.origin.y) * grid.size.x + (tile.x - grid.origin.x); };
+	auto tileOf = [&](int id) { return id == start_id ? from : id == goal_id ? to : nodes[id].piece->entrances[nodes[id].index].tile; };
+
+	auto heuristic = [&to](const sf::Vector2i& tile) -> std::uint32_t
+	{
+		int dx = std::abs(tile.x - to.x);
+		int dy = std::abs(tile.y - to.y);
+		return static_cast<std::uint32_t>(10 * std::max(dx, dy) + 4 * std::min(dx, dy));
+	};
+
+	std::vector<std::uint32_t>	cost(nodes.size() + 2, Unreachable);
+	std::vector<int>			parent(nodes.size() + 2, -1);
+
+	using Open = std::pair<std::uint32_t, int>;	// f, node
+	std::priority_queue<Open, std::vector<Open>, std::greater<Open>> open;
+
+	auto relax = [&](int current, int next, std::uint32_t step)
+	{
+		if (step == Unreachable || cost[current] + step >= cost[next])
+			return;
+
+		cost[next]		= cost[current] + step;
+		parent[next]	= current;
+		open.push({ cost[next] + heuristic(tileOf(next)), next });
+	};
+
+	cost[start_id] = 0;
+	open.push({ heuristic(from), start_id });
+
+	while (!open.empty())
+	{
+		auto [f, current] = open.top();
+		open.pop();
+
+		if (current == goal_id)
+			break;
+
+		if (f > cost[current] + heuristic(tileOf(current)))
+			continue;
+
+		if (current == start_id)
+		{
+			for (const auto& entrance : start_piece->second->entrances)
+				relax(current, by_tile[entrance.tile].ids[sideOf(entrance.tile, entrance.outside)], from_start[local(start.grid, entrance.tile)]);
+
+			if (start.chunk == goal.chunk)
+				relax(current, goal_id, from_start[local(start.grid, to)]);
+
+			continue;
+		}
+
+		const Node& node		= nodes[current];
+		const Entrance& here	= node.piece->entrances[node.index];
+		const int count			= static_cast<int>(node.piece->entrances.size());
+		const int first			= current - node.index;
+
+		// Last chunk
+		if (node.piece == goal_piece->second.get())
+			relax(current, goal_id, to_goal[local(goal.grid, here.tile)]);
+
+		// Across the chunk
+		for (int j = 0; j < count; ++j)
+		{
+			if (j != node.index)
+				relax(current, first + j, node.piece->costs[node.index * count + j]);
+		}
+
+		// Into the neighbour, onto the entrance facing back at this one
+		auto facing = by_tile.find(here.outside);
+		if (facing != by_tile.end())
+		{
+			int next = facing->second.ids[sideOf(here.outside, here.tile)];
+			if (next >= 0)
+				relax(current, next, here.outside_cost);
+		}
+	}
+
+	if (parent[goal_id] < 0)
+		return std::nullopt;
+
+	// Keep the tiles reached by stepping over a border
+	std::vector<sf::Vector2i> route{ to };
+
+	for (int id = parent[goal_id]; id != start_id && parent[id] >= 0; id = parent[id])
+	{
+		int previous = parent[id];
+		if (previous != start_id && nodes[previous].piece != nodes[id].piece)
+			route.push_back(tileOf(id));
+	}
+
+	std::reverse(route.begin(), route.end());
+
+	return route;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../map_generator/MapGenerator.h"
+
+// CHUNK GRAPH CLASS	///////////////////////////
+// Abstract graph used for long paths (HPA*). Chunk borders are split in entrances, walkable tiles facing each
+// other across two chunks. A piece holds the entrances of one chunk and the cost of crossing it between them.
+class ChunkGraph
+{
+public:
+	using Stamps = std::array<std::uint64_t, 5>;	// revisions of the chunk, then top, bottom, left, right neighbours
+
+	static constexpr std::uint32_t Unreachable = std::numeric_limits<std::uint32_t>::max();
+
+	struct Entrance {
+		sf::Vector2i	tile;				// inside the chunk, world tiles
+		sf::Vector2i	outside;			// facing tile in the neighbour chunk
+		std::uint8_t	outside_cost{ 0 };	// step cost onto the facing tile
+	};
+
+	struct Piece {
+		sf::Vector2i				chunk;			// chunk coordinate
+		Stamps						stamps{};		// what the piece was built from
+		std::vector<Entrance>		entrances;
+		std::vector<std::uint32_t>	costs;			// entrances * entrances crossing costs, row major
+	};
+
+	// Step costs of a chunk plus a one tile ring from its neighbours, taken on the main thread
+	struct Snapshot {
+		sf::Vector2i			chunk;
+		Stamps					stamps{};
+		MapGenerator::CostGrid	grid;
+	};
+
+	using PieceMap = std::unordered_map<sf::Vector2i, std::shared_ptr<const Piece>, Vector2iHash>;
+
+private:
+	PieceMap					m_pieces;
+	mutable std::shared_mutex	m_mutex;
+
+	int c_long_entrance{ 6 };	// border openings this long get an entrance at both ends
+
+public:
+
+	// MAIN FUNCTIONS (any thread)
+	std::shared_ptr<const Piece>	build(const Snapshot& snapshot) const;
+	std::shared_ptr<const Piece>	find(const sf::Vector2i& chunk) const;
+	void							insert(std::shared_ptr<const Piece> piece);
+	void							prune(const std::function<bool(const Piece&)>& keep);
+
+	static std::vector<std::uint32_t>				flood(const MapGenerator::CostGrid& grid, const sf::Vector2i& from);
+	static std::optional<std::vector<sf::Vector2i>>	search(const PieceMap& pieces, const Snapshot& start, const Snapshot& goal, const sf::Vector2i& from, const sf::Vector2i& to);
+};
@@ -0,0 +1,524 @@
+#include <pch.h>
+
+#include "FlowField.h"
+
+namespace
+{
+	const int dirs[8][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }, { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+	// Step cost from tile a onto its neighbour b, 0 if it can't be done
+	std::uint32_t stepCost(const FlowField& field, int ax, int ay, int bx, int by)
+	{
+		const int width = field.size.x;
+
+		std::uint32_t step = field.costs[by * width + bx];
+		if (step == 0)
+			return 0;
+
+		// Diagonals need both sides free
+		if (ax != bx && ay != by)
+		{
+			if (field.costs[ay * width + bx] == 0 || field.costs[by * width + ax] == 0)
+				return 0;
+
+			step = step * 14 / 10;
+		}
+
+		return step;
+	}
+
+	// Smallest rectangle holding both, an empty one counts as nothing
+	sf::IntRect merge(const sf::IntRect& a, const sf::IntRect& b)
+	{
+		if (a.size.x <= 0 || a.size.y <= 0)
+			return b;
+		if (b.size.x <= 0 || b.size.y <= 0)
+			return a;
+
+		sf::Vector2i first{ std::min(a.position.x, b.position.x), std::min(a.position.y, b.position.y) };
+		sf::Vector2i last{ std::max(a.position.x + a.size.x, b.position.x + b.size.x), std::max(a.position.y + a.size.y, b.position.y + b.size.y) };
+
+		return sf::IntRect{ first, last - first };
+	}
+}
+
+/*
+*	Once per frame. Publishes finished fields and brings the sampled ones up to date with the chunks. Only the changed
+*	chunks inside a field are integrated again, the whole field is built again when the resident area moved away from it.
+*/
+void FlowFields::update()
+{
+	++m_frame;
+
+	while (auto ready = m_ready.pop())
+	{
+		Slot& slot = m_slots[static_cast<std::size_t>((*ready)->element)];
+		slot.building = false;
+
+		// Nobody asked for it while it was built
+		if (slot.last_used >= 0)
+		{
+			slot.revision	= (*ready)->revision;
+			slot.spare		= std::move(slot.field);
+			slot.field		= std::move(*ready);
+		}
+	}
+
+	std::uint64_t revisions = m_map->getChunkRevisions();
+
+	for (std::size_t el = 0; el < ElementsCount; ++el)
+	{
+		Slot& slot = m_slots[el];
+
+		if (slot.last_used < 0 || slot.building)
+			continue;
+
+		if (m_frame - slot.last_used > m_idle_frames)
+		{
+			slot.field.reset();
+			slot.spare.reset();
+			slot.last_used = -1;
+			continue;
+		}
+
+		// Chunks were loaded or edited since the last build. The old field keeps steering until the new one is ready
+		if (slot.field && (slot.revision == revisions || m_frame - slot.last_build < m_rebuild_frames))
+			continue;
+
+		sf::IntRect area = getArea();
+		if (area.size.x <= 0 || area.size.y <= 0)
+			continue;
+
+		if (!slot.field)
+		{
+			rebuild(slot, static_cast<Elements>(el), area);
+			continue;
+		}
+
+		const FlowField& field = *slot.field;
+
+		bool moved =
+			std::abs(area.position.x - field.origin.x) > m_reanchor || std::abs(area.position.y - field.origin.y) > m_reanchor ||
+			std::abs(area.size.x - field.size.x) > m_reanchor || std::abs(area.size.y - field.size.y) > m_reanchor;
+
+		if (moved || !m_map->getChunkChanges(slot.revision, m_changed))
+		{
+			rebuild(slot, static_cast<Elements>(el), area);
+			continue;
+		}
+
+		// Parts of the field covered by the changed chunks
+		sf::IntRect bounds{ field.origin, field.size };
+		int chunk_tiles = m_map->getChunkTiles();
+
+		std::vector<sf::IntRect> overlaps;
+		long long patched = 0;
+
+		for (const auto& chunk : m_changed)
+		{
+			if (auto overlap = bounds.findIntersection(sf::IntRect{ chunk * chunk_tiles, { chunk_tiles, chunk_tiles } }))
+			{
+				overlaps.push_back(*overlap);
+				patched += static_cast<long long>(overlap->size.x) * overlap->size.y;
+			}
+		}
+
+		// Nothing the field covers changed
+		if (overlaps.empty())
+		{
+			slot.revision = revisions;
+			continue;
+		}
+
+		// Most of it changed, patching would cost more than building it again
+		if (patched * 4 > static_cast<long long>(field.size.x) * field.size.y)
+		{
+			rebuild(slot, static_cast<Elements>(el), area);
+			continue;
+		}
+
+		std::vector<Patch> patches;
+		patches.reserve(overlaps.size());
+
+		for (const auto& overlap : overlaps)
+			patches.push_back(Patch{ m_map->buildCostGrid(overlap), m_map->getElementTiles(static_cast<Elements>(el), overlap) });
+
+		patch(slot, static_cast<Elements>(el), std::move(patches));
+	}
+}
+
+/*
+*	Next tile center (px) to walk to from pos, following the field of the element. The tile itself when pos is on a goal.
+*	Returns nothing while the field is being built or when pos can't reach the element.
+*/
+std::optional<sf::Vector2i> FlowFields::sample(Elements el, const sf::Vector2i& pos)
+{
+	Slot& slot = m_slots[static_cast<std::size_t>(el)];
+	slot.last_used = m_frame;
+
+	if (!slot.field)
+		return std::nullopt;
+
+	const FlowField& field = *slot.field;
+
+	sf::Vector2i tile = m_map->worldToTile(pos);
+	if (!field.contains(tile))
+		return std::nullopt;
+
+	std::int8_t direction = field.direction[(tile.y - field.origin.y) * field.size.x + (tile.x - field.origin.x)];
+	if (direction == FlowField::None)
+		return std::nullopt;
+
+	if (direction != FlowField::Goal)
+		tile += sf::Vector2i{ dirs[direction][0], dirs[direction][1] };
+
+	return m_map->tileToWorld(tile) + sf::Vector2i{ m_map->getTileSize() / 2, m_map->getTileSize() / 2 };
+}
+
+/*
+*	Tiles a field covers: the resident ones, the middle of them when there are too many.
+*/
+sf::IntRect FlowFields::getArea() const
+{
+	sf::IntRect area = m_map->getResidentTiles();
+
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		int& position	= axis == 0 ? area.position.x : area.position.y;
+		int& size		= axis == 0 ? area.size.x : area.size.y;
+
+		if (size > m_max_size)
+		{
+			position += (size - m_max_size) / 2;
+			size = m_max_size;
+		}
+	}
+
+	return area;
+}
+
+/*
+*	Build the field of the element over the whole area on a worker. The spare field's buffers are reused.
+*/
+void FlowFields::rebuild(Slot& slot, Elements el, const sf::IntRect& area)
+{
+	auto field		= slot.spare ? std::move(slot.spare) : std::make_shared<FlowField>();
+	field->element	= el;
+	field->revision	= m_map->getChunkRevisions();
+	field->id		= ++m_ids;
+	field->base		= 0;
+	field->origin	= area.position;
+	field->size		= area.size;
+	field->costs	= m_map->buildCostGrid(area).costs;
+
+	auto goals = std::make_shared<std::vector<sf::Vector2i>>(m_map->getElementTiles(el, area));
+
+	slot.building	= true;
+	slot.last_build	= m_frame;
+
+	m_threads.detach_task([this, field, goals]
+	{
+		PROFILE_SCOPE("Path/FlowField (workers)");
+		integrate(*field, *goals);
+		m_ready.push(field);
+	});
+}
+
+/*
+*	Integrate the changed parts again on a worker, into the spare field brought up to date with the current one.
+*	Sampling keeps the current one meanwhile, the worker only reads it.
+*/
+void FlowFields::patch(Slot& slot, Elements el, std::vector<Patch> patches)
+{
+	auto changes	= std::make_shared<std::vector<Patch>>(std::move(patches));
+	auto current	= slot.field;
+	auto field		= slot.spare ? std::move(slot.spare) : std::make_shared<FlowField>();
+	auto revision	= m_map->getChunkRevisions();
+	auto id			= ++m_ids;
+
+	slot.building	= true;
+	slot.last_build	= m_frame;
+
+	m_threads.detach_task([this, current, field, changes, revision, id, el]
+	{
+		PROFILE_SCOPE("Path/FlowFieldPatch (workers)");
+
+		sync(*field, *current);
+
+		field->element	= el;
+		field->revision	= revision;
+		field->id		= id;
+		field->base		= current->id;
+
+		reintegrate(*field, *changes);
+		m_ready.push(field);
+	});
+}
+
+/*
+*	Make field a copy of from. When from was patched from field, only the tiles that patch changed are copied.
+*/
+void FlowFields::sync(FlowField& field, const FlowField& from)
+{
+	bool previous = from.base != 0 && field.id == from.base && field.origin == from.origin && field.size == from.size;
+
+	if (!previous)
+	{
+		field = from;
+		return;
+	}
+
+	const sf::IntRect& dirty = from.dirty;
+
+	for (int y = dirty.position.y; y < dirty.position.y + dirty.size.y; ++y)
+	{
+		std::size_t first = static_cast<std::size_t>(y) * from.size.x + dirty.position.x;
+		std::size_t count = static_cast<std::size_t>(dirty.size.x);
+
+		std::copy_n(from.integration.begin() + first, count, field.integration.begin() + first);
+		std::copy_n(from.direction.begin() + first, count, field.direction.begin() + first);
+		std::copy_n(from.costs.begin() + first, count, field.costs.begin() + first);
+	}
+}
+
+/*
+*	Dijkstra from all the goals at once, then every tile points to its cheapest neighbour.
+*/
+void FlowFields::integrate(FlowField& field, const std::vector<sf::Vector2i>& goals)
+{
+	field.integration.assign(field.costs.size(), FlowField::Unreachable);
+	field.direction.assign(field.costs.size(), FlowField::None);
+
+	OpenList open;
+
+	for (const auto& goal : goals)
+	{
+		int index = (goal.y - field.origin.y) * field.size.x + (goal.x - field.origin.x);
+		field.integration[index] = 0;
+		open.push({ 0, index });
+	}
+
+	propagate(field, open);
+
+	field.dirty = sf::IntRect{ { 0, 0 }, field.size };
+	setDirections(field, field.dirty);
+}
+
+/*
+*	Integrate the patched tiles again, seeded from the distances around them. Tiles whose way went through a patched
+*	tile are reset too, so costs that went up don't leave stale distances behind.
+*/
+void FlowFields::reintegrate(FlowField& field, const std::vector<Patch>& patches)
+{
+	const int width		= field.size.x;
+	const int height	= field.size.y;
+
+	thread_local std::vector<std::uint8_t>	reset;
+	thread_local std::vector<int>			invalid;
+
+	reset.assign(field.costs.size(), 0);
+	invalid.clear();
+
+	sf::Vector2i min{ width, height };
+	sf::Vector2i max{ -1, -1 };
+
+	auto invalidate = [&](int index)
+	{
+		reset[index] = 1;
+		invalid.push_back(index);
+		field.integration[index]	= FlowField::Unreachable;
+		field.direction[index]		= FlowField::None;
+
+		min = { std::min(min.x, index % width), std::min(min.y, index / width) };
+		max = { std::max(max.x, index % width), std::max(max.y, index / width) };
+	};
+
+	// New costs, the patched tiles lose their distance
+	for (const auto& patch : patches)
+	{
+		const MapGenerator::CostGrid& grid = patch.grid;
+
+		for (int y = 0; y < grid.size.y; ++y)
+		{
+			for (int x = 0; x < grid.size.x; ++x)
+			{
+				int index = (grid.origin.y - field.origin.y + y) * width + (grid.origin.x - field.origin.x + x);
+				field.costs[index] = grid.costs[static_cast<std::size_t>(y) * grid.size.x + x];
+
+				if (!reset[index])
+					invalidate(index);
+			}
+		}
+	}
+
+	// So do the tiles stepping on them or cutting their corner, and the ones stepping on those
+	for (std::size_t i = 0; i < invalid.size(); ++i)
+	{
+		int tx = invalid[i] % width;
+		int ty = invalid[i] / width;
+
+		for (const auto& dir : dirs)
+		{
+			int nx = tx + dir[0];
+			int ny = ty + dir[1];
+
+			if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+				continue;
+
+			int next = ny * width + nx;
+			std::int8_t d = field.direction[next];
+
+			if (reset[next] || d == FlowField::None || d == FlowField::Goal)
+				continue;
+
+			int sx = nx + dirs[d][0];
+			int sy = ny + dirs[d][1];
+
+			bool onto	= sx == tx && sy == ty;
+			bool corner	= sx != nx && sy != ny && ((sx == tx && ny == ty) || (nx == tx && sy == ty));
+
+			if (onto || corner)
+				invalidate(next);
+		}
+	}
+
+	// Seeds: the goals of the patches and the distances still valid around the reset tiles
+	OpenList open;
+
+	for (const auto& patch : patches)
+	{
+		for (const auto& goal : patch.goals)
+		{
+			int index = (goal.y - field.origin.y) * width + (goal.x - field.origin.x);
+			field.integration[index] = 0;
+			open.push({ 0, index });
+		}
+	}
+
+	for (int index : invalid)
+	{
+		int tx = index % width;
+		int ty = index / width;
+
+		for (const auto& dir : dirs)
+		{
+			int nx = tx + dir[0];
+			int ny = ty + dir[1];
+
+			if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+				continue;
+
+			int next = ny * width + nx;
+			if (!reset[next] && field.integration[next] != FlowField::Unreachable)
+				open.push({ field.integration[next], next });
+		}
+	}
+
+	sf::IntRect changed = merge(propagate(field, open), sf::IntRect{ min, max - min + sf::Vector2i{ 1, 1 } });
+
+	// Neighbours of a changed tile may now prefer it
+	sf::Vector2i first{ std::max(changed.position.x - 1, 0), std::max(changed.position.y - 1, 0) };
+	sf::Vector2i last{ std::min(changed.position.x + changed.size.x + 1, width), std::min(changed.position.y + changed.size.y + 1, height) };
+
+	// Every tile that changed (costs, distances or directions) is in there, the next patch copies only that
+	field.dirty = sf::IntRect{ first, last - first };
+	setDirections(field, field.dirty);
+}
+
+/*
+*	Dijkstra over the field from the open tiles. Returns the rectangle (field tiles) of the distances it lowered.
+*/
+sf::IntRect FlowFields::propagate(FlowField& field, OpenList& open)
+{
+	const int width		= field.size.x;
+	const int height	= field.size.y;
+
+	sf::Vector2i min{ width, height };
+	sf::Vector2i max{ -1, -1 };
+
+	while (!open.empty())
+	{
+		auto [cost, current] = open.top();
+		open.pop();
+
+		if (cost > field.integration[current])
+			continue;
+
+		int cx = current % width;
+		int cy = current / width;
+
+		// Walking backwards, from the neighbour onto the current tile
+		for (const auto& dir : dirs)
+		{
+			int nx = cx + dir[0];
+			int ny = cy + dir[1];
+
+			if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+				continue;
+
+			int next = ny * width + nx;
+
+			if (field.costs[next] == 0)
+				continue;
+
+			std::uint32_t step = stepCost(field, nx, ny, cx, cy);
+			if (step == 0 || cost + step >= field.integration[next])
+				continue;
+
+			field.integration[next] = cost + step;
+			open.push({ cost + step, next });
+
+			min = { std::min(min.x, nx), std::min(min.y, ny) };
+			max = { std::max(max.x, nx), std::max(max.y, ny) };
+		}
+	}
+
+	if (max.x < 0)
+		return sf::IntRect{};
+
+	return sf::IntRect{ min, max - min + sf::Vector2i{ 1, 1 } };
+}
+
+/*
+*	Directions of the tiles in the rectangle (field tiles), sampling is a single lookup.
+*/
+void FlowFields::setDirections(FlowField& field, const sf::IntRect& rect)
+{
+	const int width		= field.size.x;
+	const int height	= field.size.y;
+
+	for (int y = rect.position.y; y < rect.position.y + rect.size.y; ++y)
+	{
+		for (int x = rect.position.x; x < rect.position.x + rect.size.x; ++x)
+		{
+			int index = y * width + x;
+			field.direction[index] = field.integration[index] == 0 ? FlowField::Goal : FlowField::None;
+
+			if (field.integration[index] == 0 || field.integration[index] == FlowField::Unreachable)
+				continue;
+
+			std::uint32_t best = field.integration[index];
+
+			for (std::int8_t d = 0; d < 8; ++d)
+			{
+				int nx = x + dirs[d][0];
+				int ny = y + dirs[d][1];
+
+				if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+					continue;
+
+				std::uint32_t step = stepCost(field, x, y, nx, ny);
+				std::uint32_t through = field.integration[ny * width + nx];
+
+				if (step == 0 || through == FlowField::Unreachable)
+					continue;
+
+				if (through + step <= best)
+				{
+					best = through + step;
+					field.direction[index] = d;
+				}
+			}
+		}
+	}
+}
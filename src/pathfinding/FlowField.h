@@ -0,0 +1,94 @@
+#pragma once
+
+#include "../map_generator/MapGenerator.h"
+
+// FLOW FIELD			///////////////////////////
+// Integration field toward every tile of an element. Shared by all the entities heading to that element.
+struct FlowField {
+	static constexpr std::uint32_t	Unreachable	= std::numeric_limits<std::uint32_t>::max();
+	static constexpr std::int8_t	None		= -1;	// no way to a goal
+	static constexpr std::int8_t	Goal		= 8;	// standing on a goal
+
+	Elements					element;
+	std::uint64_t				revision{ 0 };		// chunk revisions the field was built from
+	std::uint64_t				id{ 0 };			// unique per build or patch
+	std::uint64_t				base{ 0 };			// id of the field it was patched from, 0 when built from scratch
+	sf::IntRect					dirty;				// field tiles that differ from the base
+	sf::Vector2i				origin{ 0, 0 };		// first tile
+	sf::Vector2i				size{ 0, 0 };		// in tiles
+	std::vector<std::uint32_t>	integration;		// cost to the nearest goal, row major
+	std::vector<std::int8_t>	direction;			// neighbour to step on, None or Goal
+	std::vector<std::uint8_t>	costs;				// step costs it was integrated on, row major
+
+	bool contains(const sf::Vector2i& tile) const
+	{
+		return tile.x >= origin.x && tile.y >= origin.y && tile.x < origin.x + size.x && tile.y < origin.y + size.y;
+	}
+};
+
+// FLOW FIELDS CLASS	///////////////////////////
+class FlowFields
+{
+	// Double buffered: a patch is written into the previous field, brought up to date by copying what the last patch
+	// changed, instead of copying the whole current one
+	struct Slot {
+		std::shared_ptr<FlowField>			field;				// sampled, only read once published
+		std::shared_ptr<FlowField>			spare;				// the field before it, the next patch is written here
+		std::uint64_t						revision{ 0 };		// chunk revisions the field is up to date with
+		bool								building{ false };
+		int									last_used{ -1 };	// frame of the last sample
+		int									last_build{ 0 };	// frame the last build was submitted
+	};
+
+	// New step costs and goals of a changed part of a field, clipped to it
+	struct Patch {
+		MapGenerator::CostGrid		grid;
+		std::vector<sf::Vector2i>	goals;
+	};
+
+	using Node		= std::pair<std::uint32_t, int>;	// cost, index
+	using OpenList	= std::priority_queue<Node, std::vector<Node>, std::greater<Node>>;
+
+	std::shared_ptr<MapGenerator>					m_map;
+	BS::thread_pool<>&								m_threads;
+	SharedContainer<std::shared_ptr<FlowField>>		m_ready;
+	std::array<Slot, ElementsCount>					m_slots;
+
+	std::vector<sf::Vector2i>						m_changed;		// chunks changed since a field was built, reused
+
+	std::uint64_t m_ids{ 0 };		// last FlowField::id given
+	int m_frame{ 0 };
+	int m_rebuild_frames{ 15 };		// minimum frames between two builds of the same field
+	int m_idle_frames{ 600 };		// unsampled fields are dropped after this
+	int m_max_size{ 1024 };			// tiles per side a field can cover
+	int m_reanchor{ 256 };			// tiles the resident area can drift from a field before it is built again
+
+	sf::IntRect	getArea() const;
+	void		rebuild(Slot& slot, Elements el, const sf::IntRect& area);
+	void		patch(Slot& slot, Elements el, std::vector<Patch> patches);
+
+	static void integrate(FlowField& field, const std::vector<sf::Vector2i>& goals);
+	static void reintegrate(FlowField& field, const std::vector<Patch>& patches);
+	static sf::IntRect propagate(FlowField& field, OpenList& open);
+	static void setDirections(FlowField& field, const sf::IntRect& rect);
+	static void sync(FlowField& field, const FlowField& from);
+
+public:
+
+	// CONSTRUCTOR
+	FlowFields(std::shared_ptr<MapGenerator> map, BS::thread_pool<>& threads)
+		: m_map(map)
+		, m_threads(threads)
+	{}
+
+	// DECONSTRUCTOR
+	~FlowFields()
+	{
+		// Builds write into m_ready
+		m_threads.wait();
+	}
+
+	// MAIN FUNCTIONS
+	void						update();
+	std::optional<sf::Vector2i>	sample(Elements el, const sf::Vector2i& pos);
+};
@@ -0,0 +1,360 @@
+#include <pch.h>
+
+#include "Pathfinder.h"
+
+/*
+*	Start of a frame. Collects the finished searches, resets the request cap and drops cached paths if the terrain changed.
+*/
+void Pathfinder::update()
+{
+	m_requests_frame = 0;
+
+	// Results of the workers, handed out in request order whatever order they finished in
+	std::size_t first = m_finished.size();
+	while (auto result = m_results.pop())
+		m_finished.push_back(std::move(*result));
+
+	std::sort(m_finished.begin() + first, m_finished.end(), [](const PathResult& a, const PathResult& b) { return a.id < b.id; });
+
+	// Pieces of evicted or changed chunks
+	if (++m_frames % m_prune_frames == 0)
+		m_graph.prune([this](const ChunkGraph::Piece& piece) { return m_map->getChunkRevision(piece.chunk) == piece.stamps[0]; });
+
+	if (m_cache_version != m_map->getTerrainVersion())
+	{
+		m_cache_version = m_map->getTerrainVersion();
+		m_cache.clear();
+		m_cache_index.clear();
+	}
+}
+
+/*
+*	Ask for a path between two positions in px. Returns the request id, 0 if the frame cap was reached.
+*	The result is delivered through poll().
+*/
+std::uint32_t Pathfinder::request(entt::entity entity, const sf::Vector2i& from, const sf::Vector2i& to)
+{
+	static auto& requests	= Metrics::get().counter("path.requests");
+	static auto& hits		= Metrics::get().counter("path.cache_hits");
+	static auto& throttled	= Metrics::get().counter("path.throttled");
+	static auto& routes		= Metrics::get().counter("path.routes");
+
+	PathKey key{ m_map->worldToTile(from), m_map->worldToTile(to) };
+	std::uint32_t id = m_next_id++;
+
+	requests.add();
+
+	// Recent path, no search needed
+	auto cached = m_cache_index.find(key);
+	if (cached != m_cache_index.end())
+	{
+		hits.add();
+		m_cache.splice(m_cache.begin(), m_cache, cached->second);
+		m_results.push(PathResult{ entity, id, true, false, cached->second->second });
+		return id;
+	}
+
+	if (m_requests_frame >= m_max_requests_frame)
+	{
+		throttled.add();
+		--m_next_id;
+		return 0;
+	}
+
+	++m_requests_frame;
+
+	// Far away, plan over the chunk graph first
+	int tiles = m_map->getChunkTiles();
+	if (std::max(std::abs(key.goal.x - key.start.x), std::abs(key.goal.y - key.start.y)) > m_long_distance * tiles)
+	{
+		routes.add();
+		requestRoute(entity, id, key);
+		return id;
+	}
+
+	// Search window around start and goal, copied so the worker doesn't touch the chunks
+	sf::Vector2i min{ std::min(key.start.x, key.goal.x) - m_search_margin, std::min(key.start.y, key.goal.y) - m_search_margin };
+	sf::Vector2i max{ std::max(key.start.x, key.goal.x) + m_search_margin, std::max(key.start.y, key.goal.y) + m_search_margin };
+	sf::Vector2i size{ std::min(max.x - min.x + 1, m_max_search_size), std::min(max.y - min.y + 1, m_max_search_size) };
+
+	auto grid = std::make_shared<MapGenerator::CostGrid>(m_map->buildCostGrid(sf::IntRect{ min, size }));
+	int tile_size = m_map->getTileSize();
+
+	m_threads.detach_task([this, entity, id, key, grid, tile_size]
+	{
+		PROFILE_SCOPE("Path/Search (workers)");
+
+		PathResult result{ entity, id };
+
+		if (auto path = findPath(*grid, key.start, key.goal))
+		{
+			result.found = true;
+			result.path.reserve(path->size());
+
+			for (const auto& tile : *path)
+				result.path.push_back(sf::Vector2i{ tile.x * tile_size + tile_size / 2, tile.y * tile_size + tile_size / 2 });
+		}
+
+		m_results.push(std::move(result));
+	});
+
+	return id;
+}
+
+/*
+*	Return the next finished path, if any. Successful searches are stored in the cache.
+*/
+std::optional<PathResult> Pathfinder::poll()
+{
+	if (m_finished.empty())
+		return std::nullopt;
+
+	PathResult result = std::move(m_finished.front());
+	m_finished.pop_front();
+
+	if (result.found && !result.coarse)
+	{
+		PathKey key{ m_map->worldToTile(result.path.front()), m_map->worldToTile(result.path.back()) };
+		cachePath(key, result.path);
+	}
+
+	return result;
+}
+
+/*
+*	Long request. Chunks changed since their piece was built are copied here, the pieces are rebuilt and searched on a worker.
+*	The route is refined leg by leg by the caller, with normal requests.
+*/
+void Pathfinder::requestRoute(entt::entity entity, std::uint32_t id, const PathKey& key)
+{
+	int tiles = m_map->getChunkTiles();
+
+	sf::Vector2i start_chunk{ floorDiv(key.start.x, tiles), floorDiv(key.start.y, tiles) };
+	sf::Vector2i goal_chunk{ floorDiv(key.goal.x, tiles), floorDiv(key.goal.y, tiles) };
+
+	// Region around both ends, one chunk of margin for detours
+	sf::Vector2i min{ std::min(start_chunk.x, goal_chunk.x) - 1, std::min(start_chunk.y, goal_chunk.y) - 1 };
+	sf::Vector2i max{ std::max(start_chunk.x, goal_chunk.x) + 1, std::max(start_chunk.y, goal_chunk.y) + 1 };
+
+	// Clipping the region would leave an end out of it and the search could only fail
+	if (max.x - min.x + 1 > m_max_region || max.y - min.y + 1 > m_max_region)
+	{
+		static auto& rejected = Metrics::get().counter("path.routes_rejected");
+		rejected.add();
+
+		LOG_DEBUG_RATE(1000, "Route from chunk {} {} to {} {} rejected, it spans more than {} chunks.", start_chunk.x, start_chunk.y, goal_chunk.x, goal_chunk.y, m_max_region);
+		m_results.push(PathResult{ entity, id });
+		return;
+	}
+
+	std::vector<sf::Vector2i>			region;
+	std::vector<ChunkGraph::Snapshot>	stale;
+
+	for (int cy = min.y; cy <= max.y; ++cy)
+	{
+		for (int cx = min.x; cx <= max.x; ++cx)
+		{
+			sf::Vector2i chunk{ cx, cy };
+
+			ChunkGraph::Stamps stamps = getStamps(chunk);
+			if (stamps[0] == 0)
+				continue;
+
+			region.push_back(chunk);
+
+			auto piece = m_graph.find(chunk);
+			if (!piece || piece->stamps != stamps)
+				stale.push_back(takeSnapshot(chunk));
+		}
+	}
+
+	auto start	= std::make_shared<ChunkGraph::Snapshot>(takeSnapshot(start_chunk));
+	auto goal	= std::make_shared<ChunkGraph::Snapshot>(takeSnapshot(goal_chunk));
+	int tile_size = m_map->getTileSize();
+
+	m_threads.detach_task([this, entity, id, key, region = std::move(region), stale = std::move(stale), start, goal, tile_size]
+	{
+		PROFILE_SCOPE("Path/Route (workers)");
+
+		for (const auto& snapshot : stale)
+		{
+			// Another request may have rebuilt it already
+			auto piece = m_graph.find(snapshot.chunk);
+			if (!piece || piece->stamps != snapshot.stamps)
+				m_graph.insert(m_graph.build(snapshot));
+		}
+
+		ChunkGraph::PieceMap pieces;
+		for (const auto& chunk : region)
+		{
+			if (auto piece = m_graph.find(chunk))
+				pieces[chunk] = piece;
+		}
+
+		PathResult result{ entity, id };
+		result.coarse = true;
+
+		if (auto route = ChunkGraph::search(pieces, *start, *goal, key.start, key.goal))
+		{
+			result.found = true;
+			result.path.reserve(route->size());
+
+			for (const auto& tile : *route)
+				result.path.push_back(sf::Vector2i{ tile.x * tile_size + tile_size / 2, tile.y * tile_size + tile_size / 2 });
+		}
+
+		m_results.push(std::move(result));
+	});
+}
+
+// Revisions a piece depends on, 0 for chunks that aren't loaded
+ChunkGraph::Stamps Pathfinder::getStamps(const sf::Vector2i& chunk) const
+{
+	return ChunkGraph::Stamps{
+		m_map->getChunkRevision(chunk),
+		m_map->getChunkRevision(chunk + sf::Vector2i{ 0, -1 }),
+		m_map->getChunkRevision(chunk + sf::Vector2i{ 0, 1 }),
+		m_map->getChunkRevision(chunk + sf::Vector2i{ -1, 0 }),
+		m_map->getChunkRevision(chunk + sf::Vector2i{ 1, 0 })
+	};
+}
+
+// Step costs of the chunk with a one tile ring around it
+ChunkGraph::Snapshot Pathfinder::takeSnapshot(const sf::Vector2i& chunk) const
+{
+	int tiles = m_map->getChunkTiles();
+
+	return ChunkGraph::Snapshot{ chunk, getStamps(chunk), m_map->buildCostGrid(sf::IntRect{ chunk * tiles - sf::Vector2i{ 1, 1 }, { tiles + 2, tiles + 2 } }) };
+}
+
+/*
+*	Store a path, the least recently used one goes when the cache is full.
+*/
+void Pathfinder::cachePath(const PathKey& key, const std::vector<sf::Vector2i>& path)
+{
+	if (m_cache_index.count(key))
+		return;
+
+	m_cache.emplace_front(key, path);
+	m_cache_index[key] = m_cache.begin();
+
+	if (m_cache.size() > m_cache_size)
+	{
+		m_cache_index.erase(m_cache.back().first);
+		m_cache.pop_back();
+	}
+}
+
+/*
+*	A* over the cost grid, 8 directions without cutting corners. Returns the turning points of the path in tiles.
+*/
+std::optional<std::vector<sf::Vector2i>> Pathfinder::findPath(const MapGenerator::CostGrid& grid, const sf::Vector2i& start, const sf::Vector2i& goal)
+{
+	if (!grid.contains(start) || !grid.contains(goal))
+		return std::nullopt;
+
+	const int width = grid.size.x;
+	auto index = [&grid, width](const sf::Vector2i& tile) { return (tile.y - grid.origin.y) * width + (tile.x - grid.origin.x); };
+
+	const int start_index = index(start);
+	const int goal_index = index(goal);
+
+	if (grid.costs[goal_index] == 0)
+		return std::nullopt;
+
+	// Octile distance scaled by the cheapest step (10)
+	auto heuristic = [goal_index, width](int i) -> std::uint32_t
+	{
+		int dx = std::abs(i % width - goal_index % width);
+		int dy = std::abs(i / width - goal_index / width);
+		return static_cast<std::uint32_t>(10 * std::max(dx, dy) + 4 * std::min(dx, dy));
+	};
+
+	std::vector<std::uint32_t>	cost(grid.costs.size(), std::numeric_limits<std::uint32_t>::max());
+	std::vector<std::int32_t>	parent(grid.costs.size(), -1);
+
+	using Node = std::pair<std::uint32_t, int>;	// f, index
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node>> open;
+
+	cost[start_index] = 0;
+	open.push({ heuristic(start_index), start_index });
+
+	static const int dirs[8][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }, { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+	while (!open.empty())
+	{
+		auto [f, current] = open.top();
+		open.pop();
+
+		if (current == goal_index)
+			break;
+
+		// Already reached with a better cost
+		if (f > cost[current] + heuristic(current))
+			continue;
+
+		int cx = current % width;
+		int cy = current / width;
+
+		for (const auto& dir : dirs)
+		{
+			int nx = cx + dir[0];
+			int ny = cy + dir[1];
+
+			if (nx < 0 || ny < 0 || nx >= width || ny >= grid.size.y)
+				continue;
+
+			int next = ny * width + nx;
+			std::uint32_t step = grid.costs[next];
+
+			if (step == 0)
+				continue;
+
+			// Diagonals need both sides free
+			bool diagonal = dir[0] != 0 && dir[1] != 0;
+			if (diagonal)
+			{
+				if (grid.costs[cy * width + nx] == 0 || grid.costs[ny * width + cx] == 0)
+					continue;
+
+				step = step * 14 / 10;
+			}
+
+			std::uint32_t new_cost = cost[current] + step;
+			if (new_cost < cost[next])
+			{
+				cost[next] = new_cost;
+				parent[next] = current;
+				open.push({ new_cost + heuristic(next), next });
+			}
+		}
+	}
+
+	if (start_index != goal_index && parent[goal_index] < 0)
+		return std::nullopt;
+
+	// Walk back from the goal keeping only the tiles where the direction changes
+	std::vector<sf::Vector2i> path;
+	sf::Vector2i last_dir{ 0, 0 };
+
+	for (int i = goal_index; i >= 0; i = parent[i])
+	{
+		sf::Vector2i tile{ grid.origin.x + i % width, grid.origin.y + i / width };
+
+		if (path.size() >= 2 && tile - path.back() == last_dir)
+			path.back() = tile;
+		else
+		{
+			if (!path.empty())
+				last_dir = tile - path.back();
+			path.push_back(tile);
+		}
+
+		if (i == start_index)
+			break;
+	}
+
+	std::reverse(path.begin(), path.end());
+
+	return path;
+}
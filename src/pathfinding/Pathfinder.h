@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../map_generator/MapGenerator.h"
+#include "ChunkGraph.h"
+
+// PATH KEY				///////////////////////////
+struct PathKey {
+	sf::Vector2i start;		// tile
+	sf::Vector2i goal;		// tile
+
+	bool operator==(const PathKey& other) const { return start == other.start && goal == other.goal; }
+};
+
+struct PathKeyHash {
+	std::size_t operator()(const PathKey& k) const noexcept {
+		Vector2iHash hash;
+		return hash(k.start) ^ (hash(k.goal) * 31);
+	}
+};
+
+// PATH RESULT			///////////////////////////
+struct PathResult {
+	entt::entity				entity{ entt::null };
+	std::uint32_t				id{ 0 };		// request id, matches CMoving::path_id
+	bool						found{ false };
+	bool						coarse{ false };	// path only holds chunk entrances, each leg needs its own request
+	std::vector<sf::Vector2i>	path{};			// waypoints in px (tile centers)
+};
+
+// PATHFINDER CLASS		///////////////////////////
+class Pathfinder
+{
+	std::shared_ptr<MapGenerator>	m_map;
+	BS::thread_pool<>&				m_threads;
+	SharedContainer<PathResult>		m_results;		// written by the workers
+	std::deque<PathResult>			m_finished;		// collected by update(), sorted by id
+
+	// REQUEST variables
+	std::uint32_t	m_next_id{ 1 };
+	int				m_requests_frame{ 0 };
+	int				m_max_requests_frame{ 32 };		// new searches per frame
+	int				m_search_margin{ 16 };			// tiles around start and goal the search can use
+	int				m_max_search_size{ 256 };		// tiles per side of the search window
+
+	// HIERARCHICAL variables
+	ChunkGraph		m_graph;
+	int				m_long_distance{ 2 };			// chunks apart before the chunk graph is used
+	int				m_max_region{ 32 };				// chunks per side the chunk graph search can use
+	int				m_prune_frames{ 300 };			// frames between removals of stale pieces
+	int				m_frames{ 0 };
+
+	// CACHE variables (main thread only)
+	using CacheList = std::list<std::pair<PathKey, std::vector<sf::Vector2i>>>;
+
+	CacheList															m_cache;
+	std::unordered_map<PathKey, CacheList::iterator, PathKeyHash>		m_cache_index;
+	std::size_t															m_cache_size{ 256 };
+	std::uint64_t														m_cache_version{ 0 };
+
+	// SEARCH
+	static std::optional<std::vector<sf::Vector2i>> findPath(const MapGenerator::CostGrid& grid, const sf::Vector2i& start, const sf::Vector2i& goal);
+
+	void cachePath(const PathKey& key, const std::vector<sf::Vector2i>& path);
+
+	ChunkGraph::Stamps		getStamps(const sf::Vector2i& chunk) const;
+	ChunkGraph::Snapshot	takeSnapshot(const sf::Vector2i& chunk) const;
+	void					requestRoute(entt::entity entity, std::uint32_t id, const PathKey& key);
+
+public:
+
+	// CONSTRUCTOR
+	Pathfinder(std::shared_ptr<MapGenerator> map, BS::thread_pool<>& threads)
+		: m_map(map)
+		, m_threads(threads)
+	{}
+
+	// DECONSTRUCTOR
+	~Pathfinder()
+	{
+		// Searches write into m_results
+		m_threads.wait();
+	}
+
+	// MAIN FUNCTIONS
+	void						update();
+	std::uint32_t				request(entt::entity entity, const sf::Vector2i& from, const sf::Vector2i& to);
+	std::optional<PathResult>	poll();			// results collected by the last update()
+};
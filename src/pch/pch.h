@@ -5,12 +5,19 @@
 #include <fstream>
 
 #include <memory>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <future>
 #include <vector>
+#include <deque>
+#include <list>
+#include <queue>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <functional>
+#include <shared_mutex>
 
 // Custom headers
 #include "FastNoiseLite.h"
@@ -19,6 +26,9 @@
 #include "Logger.h"
 #include "GameClock.h"
 #include "SharedContainer.h"
+#include "Trace.h"
+#include "Profiler.h"
+#include "Metrics.h"
 
 // SFML library
 #include <SFML/Graphics.hpp>
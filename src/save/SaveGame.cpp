@@ -0,0 +1,420 @@
+#include <pch.h>
+
+#include <cstring>
+#include <filesystem>
+
+#include "SaveGame.h"
+#include "MappedFile.h"
+
+namespace
+{
+	// Stream a section straight from the records
+	template<typename T>
+	void writeSection(std::ofstream& out, std::uint32_t tag, const T* records, std::size_t count, std::uint32_t record_size = sizeof(T))
+	{
+		Save::Section section{ tag, record_size, count };
+		out.write(reinterpret_cast<const char*>(&section), sizeof(section));
+		out.write(reinterpret_cast<const char*>(records), static_cast<std::streamsize>(count * record_size));
+	}
+
+	// Sections of a mapped file, records aren't copied until they are read
+	struct SectionView {
+		std::uint32_t		record_size{ 0 };
+		std::uint64_t		count{ 0 };
+		const std::uint8_t*	data{ nullptr };
+
+		// Records of older versions are shorter, the missing fields keep their defaults
+		template<typename T>
+		T read(std::uint64_t index) const
+		{
+			T record{};
+			std::memcpy(&record, data + index * record_size, std::min<std::size_t>(record_size, sizeof(T)));
+			return record;
+		}
+	};
+}
+
+/*
+*	Copy the world and write it in the background. Returns false if the previous save is still being written.
+*/
+bool SaveGame::save(const std::string& file)
+{
+	if (m_saving.exchange(true))
+		return false;
+
+	std::shared_ptr<Save::Snapshot> snapshot;
+	{
+		PROFILE_SCOPE("Save/Capture");
+		snapshot = std::make_shared<Save::Snapshot>(capture());
+	}
+
+	m_thread.detach_task([this, snapshot, file]
+	{
+		PROFILE_SCOPE("Save/Write (worker)");
+
+		if (write(*snapshot, file))
+			LOG_INFO("World saved to {}, {} entities.", file, snapshot->entities.size());
+		else
+			LOG_ERROR("Could not save the world to {}.", file);
+
+		m_saving = false;
+	});
+
+	return true;
+}
+
+/*
+*	Flat copy of everything a save holds. Runs on the main thread, while the simulation is stopped.
+*/
+Save::Snapshot SaveGame::capture() const
+{
+	Save::Snapshot snapshot;
+	snapshot.map = m_map->getSaveState();
+
+	Save::WorldRecord& world	= snapshot.world;
+	world.seed					= snapshot.map.seed;
+	world.tiles_per_side		= snapshot.map.tiles_per_side;
+	world.cont_multiplier		= snapshot.map.cont_multiplier;
+	world.mineral_multiplier	= snapshot.map.mineral_multiplier;
+	world.cont_freq				= snapshot.map.cont_freq;
+	world.warp_freq				= snapshot.map.warp_freq;
+	world.mineral_freq			= snapshot.map.mineral_freq;
+	world.clock_minutes			= m_game_clock->getTimestamp();
+	world.tick					= m_entity_manager.getTick();
+	std::copy(snapshot.map.thresholds.begin(), snapshot.map.thresholds.end(), world.thresholds);
+
+	auto& registry = m_entity_manager.getRegistry();
+	auto view = registry.view<CType, CPersonality, CTransform, CPosition, CWaypoint, CBasicNeeds, CMemory, CActionsQueue>();
+
+	snapshot.entities.reserve(view.size_hint());
+
+	view.each([&](auto entity, auto& type, auto& personality, auto& trs, auto& pos, auto& wp, auto& needs, auto& memory, auto& queue)
+	{
+		auto index = static_cast<std::uint32_t>(snapshot.entities.size());
+
+		Save::EntityRecord& record = snapshot.entities.emplace_back();
+		record.id			= static_cast<std::uint32_t>(entt::to_integral(entity));
+		record.type			= static_cast<std::uint32_t>(type.type);
+		record.position[0]	= pos.value.x;
+		record.position[1]	= pos.value.y;
+		record.waypoint[0]	= wp.value.x;
+		record.waypoint[1]	= wp.value.y;
+		record.speed		= trs.speed;
+		record.target[0]	= trs.target.x;
+		record.target[1]	= trs.target.y;
+		record.thirst		= needs.thirst;
+		record.hunger		= needs.hunger;
+		record.sleep		= needs.sleep;
+		record.last_update	= needs.last_update;
+
+		if (auto* life = registry.try_get<CLifespan>(entity))
+		{
+			record.lifespan_remaining	= life->remaining;
+			record.lifespan_total		= life->total;
+		}
+
+		for (const auto& [trait, value] : personality.traits)
+		{
+			if (trait >= 0 && trait < static_cast<int>(PersonalityTrait::End))
+				record.traits[trait] = static_cast<std::uint8_t>(value);
+		}
+
+		for (std::size_t el = 0; el < ElementsCount; ++el)
+		{
+			for (std::size_t slot = 0; slot < CMemory::Slots; ++slot)
+			{
+				const auto& entry = memory.locations[el][slot];
+				if (entry.timestamp < 0)
+					continue;
+
+				snapshot.memories.push_back(Save::MemoryRecord{ index, static_cast<std::uint8_t>(el), static_cast<std::uint8_t>(slot), 0, entry.pos.x, entry.pos.y, entry.timestamp });
+			}
+		}
+
+		for (const auto& action : queue.actions)
+		{
+			Save::ActionRecord act{ index, static_cast<std::uint32_t>(action->action_name) };
+
+			if (auto moving = std::dynamic_pointer_cast<CMoving>(action))
+			{
+				act.target[0]	= moving->target.x;
+				act.target[1]	= moving->target.y;
+				act.resource	= moving->resource ? static_cast<std::int32_t>(*moving->resource) : -1;
+			}
+			else if (auto eating = std::dynamic_pointer_cast<CEating>(action))
+			{
+				act.timestamp	= eating->timestamp_min;
+				act.duration	= eating->duration_min;
+			}
+			else if (auto drinking = std::dynamic_pointer_cast<CDrinking>(action))
+			{
+				act.timestamp	= drinking->timestamp_min;
+				act.duration	= drinking->duration_min;
+			}
+			else if (auto sleeping = std::dynamic_pointer_cast<CSleeping>(action))
+			{
+				act.timestamp	= sleeping->timestamp_min;
+				act.duration	= sleeping->duration_min;
+			}
+
+			snapshot.actions.push_back(act);
+		}
+	});
+
+	return snapshot;
+}
+
+/*
+*	Encode the snapshot to a temporary file and move it over the old save, a crash never leaves half a save behind.
+*/
+bool SaveGame::write(const Save::Snapshot& snapshot, const std::string& file)
+{
+	std::filesystem::path path{ file };
+	std::filesystem::path temp{ file + ".tmp" };
+
+	std::error_code error;
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), error);
+
+	{
+		std::vector<char> buffer(1 << 20);
+
+		std::ofstream out;
+		out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		out.open(temp, std::ios::binary | std::ios::trunc);
+
+		if (!out)
+			return false;
+
+		Save::Header header;
+		header.sections = 5;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		writeSection(out, Save::TagWorld, &snapshot.world, 1);
+
+		// Chunk position followed by its tiles, one byte each
+		std::size_t tiles = static_cast<std::size_t>(snapshot.map.tiles_per_side) * snapshot.map.tiles_per_side;
+		std::vector<std::uint8_t> edits;
+		edits.reserve(snapshot.map.edited.size() * (sizeof(Save::ChunkRecord) + tiles));
+
+		for (const auto& [coord, chunk_tiles] : snapshot.map.edited)
+		{
+			Save::ChunkRecord chunk{ coord.x, coord.y };
+			const auto* bytes = reinterpret_cast<const std::uint8_t*>(&chunk);
+
+			edits.insert(edits.end(), bytes, bytes + sizeof(chunk));
+			edits.insert(edits.end(), reinterpret_cast<const std::uint8_t*>(chunk_tiles.data()), reinterpret_cast<const std::uint8_t*>(chunk_tiles.data()) + tiles);
+		}
+
+		writeSection(out, Save::TagEdits, edits.data(), snapshot.map.edited.size(), static_cast<std::uint32_t>(sizeof(Save::ChunkRecord) + tiles));
+		writeSection(out, Save::TagEntities, snapshot.entities.data(), snapshot.entities.size());
+		writeSection(out, Save::TagMemories, snapshot.memories.data(), snapshot.memories.size());
+		writeSection(out, Save::TagActions, snapshot.actions.data(), snapshot.actions.size());
+
+		out.flush();
+		if (!out)
+			return false;
+	}
+
+	std::filesystem::rename(temp, path, error);
+	return !error;
+}
+
+/*
+*	Replace the world with the one in the file. Returns false, leaving the world untouched, if the file isn't a valid save.
+*/
+bool SaveGame::load(const std::string& file)
+{
+	PROFILE_SCOPE("Save/Load");
+
+	MappedFile mapped{ file };
+	if (!mapped || mapped.size() < sizeof(Save::Header))
+	{
+		LOG_ERROR("Could not open the save {}.", file);
+		return false;
+	}
+
+	Save::Header header;
+	std::memcpy(&header, mapped.data(), sizeof(header));
+
+	if (header.magic != Save::Magic || header.version == 0 || header.version > Save::Version)
+	{
+		LOG_ERROR("{} is not a save of this version (file version {}).", file, header.version);
+		return false;
+	}
+
+	// Find the sections, checking they fit in the file
+	std::unordered_map<std::uint32_t, SectionView> sections;
+	std::size_t offset = sizeof(header);
+
+	for (std::uint32_t i = 0; i < header.sections; ++i)
+	{
+		Save::Section section;
+		if (mapped.size() - offset < sizeof(section))
+			break;
+
+		std::memcpy(&section, mapped.data() + offset, sizeof(section));
+		offset += sizeof(section);
+
+		if (section.record_size == 0 || section.count > (mapped.size() - offset) / section.record_size)
+		{
+			LOG_ERROR("The save {} is truncated.", file);
+			return false;
+		}
+
+		sections[section.tag] = SectionView{ section.record_size, section.count, mapped.data() + offset };
+		offset += section.record_size * section.count;
+	}
+
+	auto world_section = sections.find(Save::TagWorld);
+	if (world_section == sections.end() || world_section->second.count != 1)
+	{
+		LOG_ERROR("The save {} has no world.", file);
+		return false;
+	}
+
+	auto world = world_section->second.read<Save::WorldRecord>(0);
+
+	// Missing sections are empty
+	SectionView& entities_section	= sections[Save::TagEntities];
+	SectionView& memories_section	= sections[Save::TagMemories];
+	SectionView& actions_section	= sections[Save::TagActions];
+	SectionView& edits_section		= sections[Save::TagEdits];
+
+	// MAP
+
+	MapGenerator::SaveState map;
+	map.seed				= world.seed;
+	map.tiles_per_side		= world.tiles_per_side;
+	map.cont_multiplier		= world.cont_multiplier;
+	map.mineral_multiplier	= world.mineral_multiplier;
+	map.cont_freq			= world.cont_freq;
+	map.warp_freq			= world.warp_freq;
+	map.mineral_freq		= world.mineral_freq;
+	std::copy(std::begin(world.thresholds), std::end(world.thresholds), map.thresholds.begin());
+
+	std::size_t tiles = static_cast<std::size_t>(world.tiles_per_side) * world.tiles_per_side;
+	if (edits_section.count > 0 && edits_section.record_size == sizeof(Save::ChunkRecord) + tiles)
+	{
+		map.edited.reserve(edits_section.count);
+
+		for (std::uint64_t i = 0; i < edits_section.count; ++i)
+		{
+			auto chunk = edits_section.read<Save::ChunkRecord>(i);
+			const auto* first = reinterpret_cast<const Elements*>(edits_section.data + i * edits_section.record_size + sizeof(Save::ChunkRecord));
+
+			sf::Vector2i coord{ chunk.x, chunk.y };
+			if (header.version < 2)
+				coord = floorDiv(coord, world.tiles_per_side * m_map->getTileSize());
+
+			map.edited.emplace_back(coord, std::vector<Elements>(first, first + tiles));
+		}
+	}
+
+	m_map->loadSaveState(map);
+	m_game_clock->setTimestamp(world.clock_minutes);
+	m_entity_manager.setTick(world.tick);
+
+	// ENTITIES
+	m_entity_manager.clear();
+
+	auto& registry = m_entity_manager.getRegistry();
+	std::vector<entt::entity> created(entities_section.count);
+
+	for (std::uint64_t i = 0; i < entities_section.count; ++i)
+	{
+		auto record = entities_section.read<Save::EntityRecord>(i);
+		auto entity = m_entity_manager.addEntity(static_cast<EntityType>(record.type), static_cast<entt::entity>(record.id));
+		created[i] = entity;
+
+		sf::Vector2f position{ record.position[0], record.position[1] };
+
+		auto& trs	= registry.get<CTransform>(entity);
+		trs.speed	= record.speed;
+		trs.target	= { record.target[0], record.target[1] };
+		trs.pos		= sf::Vector2i{ static_cast<int>(std::lround(position.x)), static_cast<int>(std::lround(position.y)) };
+
+		registry.get<CPosition>(entity).value = position;
+		registry.get<CWaypoint>(entity).value = { record.waypoint[0], record.waypoint[1] };
+
+		auto& needs			= registry.get<CBasicNeeds>(entity);
+		needs.thirst		= record.thirst;
+		needs.hunger		= record.hunger;
+		needs.sleep			= record.sleep;
+		needs.last_update	= record.last_update;
+
+		if (record.lifespan_total >= 0)
+		{
+			auto& life		= registry.get_or_emplace<CLifespan>(entity, record.lifespan_total);
+			life.remaining	= record.lifespan_remaining;
+		}
+		else
+		{
+			registry.remove<CLifespan>(entity);
+		}
+
+		auto& personality = registry.get<CPersonality>(entity);
+		for (int trait = 0; trait < static_cast<int>(PersonalityTrait::End); ++trait)
+			personality.traits[trait] = record.traits[trait];
+	}
+
+	for (std::uint64_t i = 0; i < memories_section.count; ++i)
+	{
+		auto record = memories_section.read<Save::MemoryRecord>(i);
+		if (record.entity >= created.size() || record.element >= ElementsCount || record.slot >= CMemory::Slots)
+			continue;
+
+		auto& entry		= registry.get<CMemory>(created[record.entity]).locations[record.element][record.slot];
+		entry.pos		= { record.x, record.y };
+		entry.timestamp	= record.timestamp;
+	}
+
+	for (std::uint64_t i = 0; i < actions_section.count; ++i)
+	{
+		auto record = actions_section.read<Save::ActionRecord>(i);
+		if (record.entity >= created.size())
+			continue;
+
+		auto& queue = registry.get<CActionsQueue>(created[record.entity]);
+		auto type = static_cast<ActionTypes>(record.type);
+
+		switch (type)
+		{
+		case ActionTypes::Moving:
+		{
+			std::optional<Elements> resource;
+			if (record.resource >= 0 && record.resource < static_cast<std::int32_t>(ElementsCount))
+				resource = static_cast<Elements>(record.resource);
+
+			queue.actions.push_back(std::make_shared<CMoving>(type, sf::Vector2i{ record.target[0], record.target[1] }, resource));
+			break;
+		}
+		case ActionTypes::Eating:
+		{
+			auto action = std::make_shared<CEating>(type, record.timestamp);
+			action->duration_min = record.duration;
+			queue.actions.push_back(action);
+			break;
+		}
+		case ActionTypes::Drinking:
+		{
+			auto action = std::make_shared<CDrinking>(type, record.timestamp);
+			action->duration_min = record.duration;
+			queue.actions.push_back(action);
+			break;
+		}
+		case ActionTypes::Sleeping:
+		{
+			auto action = std::make_shared<CSleeping>(type, record.timestamp);
+			action->duration_min = record.duration;
+			queue.actions.push_back(action);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	LOG_INFO("World loaded from {}, {} entities.", file, entities_section.count);
+	return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../map_generator/MapGenerator.h"
+#include "../entity_manager/EntityManager.h"
+
+// SAVE FILE FORMAT
+// Little endian, written as laid out in memory. A header, then sections of fixed size records:
+//   Header		magic "OOTS", version, section count
+//   Section	tag, record size, record count, then the records
+// Readers skip unknown tags and copy min(record size, sizeof(record)) bytes of every record, so a newer version can
+// append fields to a record or add sections without breaking older saves.
+namespace Save
+{
+	constexpr std::array<char, 4>	Magic{ 'O', 'O', 'T', 'S' };
+	constexpr std::uint32_t			Version{ 2 };		// 2: edited chunks are stored by chunk coordinate
+
+	// Section tags
+	constexpr std::uint32_t makeTag(char a, char b, char c, char d)
+	{
+		return static_cast<std::uint32_t>(a) | static_cast<std::uint32_t>(b) << 8 | static_cast<std::uint32_t>(c) << 16 | static_cast<std::uint32_t>(d) << 24;
+	}
+
+	constexpr std::uint32_t TagWorld	= makeTag('W', 'R', 'L', 'D');		// one WorldRecord
+	constexpr std::uint32_t TagEdits	= makeTag('E', 'D', 'I', 'T');		// ChunkRecord followed by the tiles of the chunk
+	constexpr std::uint32_t TagEntities	= makeTag('E', 'N', 'T', 'S');		// EntityRecord
+	constexpr std::uint32_t TagMemories	= makeTag('M', 'E', 'M', 'O');		// MemoryRecord, only the used slots
+	constexpr std::uint32_t TagActions	= makeTag('A', 'C', 'T', 'S');		// ActionRecord, in queue order
+
+	struct Header {
+		std::array<char, 4>	magic{ Magic };
+		std::uint32_t		version{ Version };
+		std::uint32_t		sections{ 0 };
+		std::uint32_t		reserved{ 0 };
+	};
+
+	struct Section {
+		std::uint32_t	tag{ 0 };
+		std::uint32_t	record_size{ 0 };
+		std::uint64_t	count{ 0 };
+	};
+
+	struct WorldRecord {
+		std::int32_t	seed{ 0 };
+		std::int32_t	tiles_per_side{ 0 };
+		float			cont_multiplier{ 0.f };
+		float			mineral_multiplier{ 0.f };
+		double			cont_freq{ 0.0 };
+		double			warp_freq{ 0.0 };
+		double			mineral_freq{ 0.0 };
+		float			thresholds[ElementsCount]{};
+		std::int64_t	clock_minutes{ 0 };
+		std::uint64_t	tick{ 0 };
+	};
+
+	struct ChunkRecord {
+		std::int32_t	x{ 0 };			// chunk coordinate (version 1: chunk position in px)
+		std::int32_t	y{ 0 };
+	};
+
+	struct EntityRecord {
+		std::uint32_t	id{ 0 };
+		std::uint32_t	type{ 0 };
+		float			position[2]{};
+		float			waypoint[2]{};
+		float			speed{ 0.f };
+		std::int32_t	target[2]{};
+		std::int32_t	thirst{ 0 };
+		std::int32_t	hunger{ 0 };
+		std::int32_t	sleep{ 0 };
+		std::int32_t	last_update{ 0 };
+		std::int32_t	lifespan_remaining{ -1 };	// -1 without a lifespan
+		std::int32_t	lifespan_total{ -1 };
+		std::uint8_t	traits[static_cast<std::size_t>(PersonalityTrait::End)]{};
+	};
+
+	struct MemoryRecord {
+		std::uint32_t	entity{ 0 };	// index in the entity section
+		std::uint8_t	element{ 0 };
+		std::uint8_t	slot{ 0 };
+		std::uint16_t	reserved{ 0 };
+		std::int32_t	x{ 0 };
+		std::int32_t	y{ 0 };
+		std::int64_t	timestamp{ 0 };
+	};
+
+	struct ActionRecord {
+		std::uint32_t	entity{ 0 };	// index in the entity section
+		std::uint32_t	type{ 0 };		// ActionTypes
+		std::int32_t	target[2]{};	// moving
+		std::int64_t	timestamp{ 0 };	// eating, drinking, sleeping
+		std::int32_t	duration{ 0 };
+		std::int32_t	resource{ -1 };	// moving towards an element, -1 if none
+	};
+
+	static_assert(sizeof(Header) == 16 && sizeof(Section) == 16, "save headers must not be padded");
+	static_assert(sizeof(MemoryRecord) == 24 && sizeof(ActionRecord) == 32, "save records must not be padded");
+
+	// Plain copy of the world, taken on the main thread and written on the save thread
+	struct Snapshot {
+		WorldRecord					world;
+		MapGenerator::SaveState		map;
+		std::vector<EntityRecord>	entities;
+		std::vector<MemoryRecord>	memories;
+		std::vector<ActionRecord>	actions;
+	};
+}
+
+// SAVE AND LOAD
+// Saving copies the world into flat records on the caller thread, which is the only pause, then encodes and writes
+// them on a background thread. Loading maps the file and rebuilds the world from the records in place.
+//
+// Paths and move plans aren't saved, moving entities ask for a new path after loading.
+class SaveGame
+{
+	std::shared_ptr<MapGenerator>	m_map;
+	std::shared_ptr<GameClock>		m_game_clock;
+	EntityManager&					m_entity_manager;
+
+	BS::thread_pool<>				m_thread{ 1, [](std::size_t) { Trace::get().setThreadName("save writer"); } };
+	std::atomic<bool>				m_saving{ false };
+
+	Save::Snapshot	capture() const;
+	static bool		write(const Save::Snapshot& snapshot, const std::string& file);
+
+public:
+
+	// CONSTRUCTOR
+	SaveGame(std::shared_ptr<MapGenerator> map, std::shared_ptr<GameClock> clock, EntityManager& entities)
+		: m_map(map)
+		, m_game_clock(clock)
+		, m_entity_manager(entities)
+	{}
+
+	// DECONSTRUCTOR
+	~SaveGame()
+	{
+		// A save in progress is finished, not dropped
+		m_thread.wait();
+	}
+
+	// MAIN FUNCTIONS
+	bool save(const std::string& file);
+	bool load(const std::string& file);
+
+	// GETTERS
+	bool isSaving() const { return m_saving.load(); }
+};